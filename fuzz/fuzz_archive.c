@@ -0,0 +1,30 @@
+// fuzz target: archive detection and index parsing, then every member
+// through the decoder (nothing is written to disk)
+#include "huffman.h"
+#include "kernels.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    static FILE *sink;
+    if (!sink){
+        SelectKernels(NULL);
+        sink = fopen("/dev/null", "wb");
+    }
+    int file_count;
+    file_index_t *index = ParseArchiveIndex(data, size, &file_count);
+    if (!index){
+        return 0;
+    }
+    for (int i = 0; i < file_count; i++){
+        IsSafePath(index[i].filename);
+        MaxDecodedSize(data + index[i].position, index[i].length);
+        DecompressMemory(data + index[i].position, index[i].length, sink);
+    }
+    free(index);
+    return 0;
+}
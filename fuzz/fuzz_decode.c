@@ -0,0 +1,17 @@
+// fuzz target: one compressed stream through the decoder
+#include "huffman.h"
+#include "kernels.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    static FILE *sink;
+    if (!sink){
+        SelectKernels(NULL);
+        sink = fopen("/dev/null", "wb");
+    }
+    DecompressMemory(data, size, sink);
+    return 0;
+}
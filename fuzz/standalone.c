@@ -0,0 +1,48 @@
+// main() for the fuzz targets without libFuzzer (gcc sanitizer builds, AFL):
+// runs every file given on the command line, or stdin, through the target
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+
+int RunFile(FILE *file){
+    size_t capacity = 65536;
+    size_t size = 0;
+    uint8_t *data = malloc(capacity);
+    size_t read;
+    while ((read = fread(data + size, 1, capacity - size, file))){
+        size += read;
+        if (size == capacity){
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    // exact size, so that reads past the end are caught by the sanitizers
+    uint8_t *input = malloc(size ? size : 1);
+    memcpy(input, data, size);
+    free(data);
+    LLVMFuzzerTestOneInput(input, size);
+    free(input);
+    return 0;
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc < 2){
+        return RunFile(stdin);
+    }
+    for (int i = 1; i < argc; i++){
+        FILE *file = fopen(argv[i], "rb");
+        if (!file){
+            fprintf(stderr, "Cannot open %s.\n", argv[i]);
+            return 1;
+        }
+        RunFile(file);
+        fclose(file);
+    }
+    return 0;
+}
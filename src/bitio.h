@@ -0,0 +1,163 @@
+#ifndef BITIO_H
+#define BITIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// size of the byte buffers between bit registers and files
+#define BITIO_BUFFER_SIZE 4096
+
+
+// MSB-first bit writer (same bit order as CompressTree)
+typedef struct bit_writer_t {
+    FILE *output;
+    uint64_t buffer; // pending bits, right-aligned
+    int bit_pos; // number of pending bits
+    int byte_count;
+    unsigned char bytes[BITIO_BUFFER_SIZE];
+} bit_writer_t;
+
+
+// input of the decoders: a file read through a buffer, or a block of memory
+typedef struct byte_source_t {
+    FILE *file; // NULL for memory
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    unsigned char buffer[BITIO_BUFFER_SIZE];
+} byte_source_t;
+
+
+// MSB-first bit reader, reads zeros past the end of input
+typedef struct bit_reader_t {
+    byte_source_t *source;
+    uint64_t buffer; // unread bits, right-aligned
+    int bit_count; // number of unread bits
+} bit_reader_t;
+
+
+static inline void InitBitWriter(bit_writer_t *writer, FILE *output){
+    writer->output = output;
+    writer->buffer = 0;
+    writer->bit_pos = 0;
+    writer->byte_count = 0;
+}
+
+
+// code length must be at most 32 bits
+static inline void PutBits(bit_writer_t *writer, uint32_t bits, int length){
+    writer->buffer = (writer->buffer << length) | bits;
+    writer->bit_pos += length;
+    while (writer->bit_pos >= 8){
+        writer->bit_pos -= 8;
+        writer->bytes[writer->byte_count++] = (unsigned char)(writer->buffer >> writer->bit_pos);
+        if (writer->byte_count == BITIO_BUFFER_SIZE){
+            fwrite(writer->bytes, 1, BITIO_BUFFER_SIZE, writer->output);
+            writer->byte_count = 0;
+        }
+    }
+}
+
+
+// codes built from a tree can be longer than 32 bits
+static inline void PutLongBits(bit_writer_t *writer, uint64_t bits, int length){
+    if (length > 32){
+        PutBits(writer, (uint32_t)(bits >> 32), length - 32);
+        length = 32;
+    }
+    PutBits(writer, (uint32_t)bits, length);
+}
+
+
+// write remaining bits (zero padded) and buffered bytes
+static inline void FlushBits(bit_writer_t *writer){
+    if (writer->bit_pos > 0){
+        PutBits(writer, 0, 8 - writer->bit_pos);
+    }
+    fwrite(writer->bytes, 1, writer->byte_count, writer->output);
+    writer->byte_count = 0;
+}
+
+
+static inline void InitFileSource(byte_source_t *source, FILE *file){
+    source->file = file;
+    source->data = source->buffer;
+    source->size = 0;
+    source->pos = 0;
+}
+
+
+static inline void InitMemorySource(byte_source_t *source, const unsigned char *data, size_t size){
+    source->file = NULL;
+    source->data = data;
+    source->size = size;
+    source->pos = 0;
+}
+
+
+// returns 0 when the source is exhausted
+static inline int FillSource(byte_source_t *source){
+    if (source->pos < source->size){
+        return 1;
+    }
+    if (!source->file){
+        return 0;
+    }
+    source->size = fread(source->buffer, 1, BITIO_BUFFER_SIZE, source->file);
+    source->pos = 0;
+    return source->size > 0;
+}
+
+
+// returns number of bytes read
+static inline size_t ReadSource(byte_source_t *source, void *dst, size_t size){
+    size_t done = 0;
+    while (done < size && FillSource(source)){
+        size_t n = source->size - source->pos;
+        if (n > size - done){
+            n = size - done;
+        }
+        memcpy((unsigned char*)dst + done, source->data + source->pos, n);
+        source->pos += n;
+        done += n;
+    }
+    return done;
+}
+
+
+static inline int GetSourceByte(byte_source_t *source){
+    return FillSource(source) ? source->data[source->pos++] : EOF;
+}
+
+
+static inline void InitBitReader(bit_reader_t *reader, byte_source_t *source){
+    reader->source = source;
+    reader->buffer = 0;
+    reader->bit_count = 0;
+}
+
+
+// make sure at least 57 bits are available
+static inline void RefillBits(bit_reader_t *reader){
+    byte_source_t *source = reader->source;
+    while (reader->bit_count <= 56){
+        // past the end: feed zeros
+        unsigned char byte = FillSource(source) ? source->data[source->pos++] : 0;
+        reader->buffer = (reader->buffer << 8) | byte;
+        reader->bit_count += 8;
+    }
+}
+
+
+// n must be in [1, 32] and not greater than bit_count
+static inline uint32_t PeekBits(bit_reader_t *reader, int n){
+    return (uint32_t)(reader->buffer >> (reader->bit_count - n)) & (uint32_t)((1ull << n) - 1);
+}
+
+
+static inline void SkipBits(bit_reader_t *reader, int n){
+    reader->bit_count -= n;
+}
+
+#endif
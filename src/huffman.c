@@ -3,6 +3,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "bitio.h"
+#include "transform.h"
+#include "kernels.h"
+#include "stats.h"
+
+// header size of one context table (code lengths packed two per byte), in bits
+#define CONTEXT_TABLE_COST (128 * 8)
 
 
 void Swap(tree_node_t **a, tree_node_t **b){
@@ -62,6 +71,11 @@ tree_node_t* BuildHuffmanTree(int symbol_count, int *frequency){
             heap[size++] = node;
         }
     }
+    if (!size){
+        free(heap);
+        return NULL;
+    }
+
     // building min heap
     for (int i = (size - 2) / 2; i >= 0; i--){
         HeapifyDown(heap, size, i);
@@ -104,10 +118,19 @@ tree_node_t* BuildHuffmanTree(int symbol_count, int *frequency){
 
 
 void BuildCodes(tree_node_t *node, huffman_code_t *codes, char *code, int depth){
+    // a lone symbol still needs one bit
+    if (!depth && !node->left && !node->right){
+        code[depth] = '0';
+        depth = 1;
+    }
     if (!node->left && !node->right){
         code[depth] = '\0';
         strcpy(codes[node->symbol].code, code);
         codes[node->symbol].length = depth;
+        codes[node->symbol].bits = 0;
+        for (int i = 0; i < depth; i++){
+            codes[node->symbol].bits = codes[node->symbol].bits << 1 | (code[i] == '1');
+        }
         return;
     }
 
@@ -123,49 +146,453 @@ void BuildCodes(tree_node_t *node, huffman_code_t *codes, char *code, int depth)
 }
 
 
-void CompressTree(FILE *input, FILE *output, huffman_code_t *codes, int symbol_size, int *frequency){
-    int symbol_range = symbol_size == 8 ? 256 : 65536;
+// table of the next DECODE_TABLE_BITS bits for decoding a tree
+void BuildDecodeTable(tree_node_t *tree, decode_entry_t *table){
+    for (int prefix = 0; prefix < 1 << DECODE_TABLE_BITS; prefix++){
+        decode_entry_t *entry = &table[prefix];
+        tree_node_t *node = tree;
+        int length = 0;
+        while (node && (node->left || node->right) && length < DECODE_TABLE_BITS){
+            int bit = prefix >> (DECODE_TABLE_BITS - 1 - length) & 1;
+            node = bit ? node->right : node->left;
+            length++;
+        }
+        if (!node){
+            // unused prefix of an incomplete code
+            entry->node = NULL;
+            entry->symbol = -1;
+        } else if (node->left || node->right){
+            // code is longer than the table
+            entry->node = node;
+            entry->symbol = -1;
+        } else{
+            entry->node = NULL;
+            entry->symbol = node->symbol;
+        }
+        // a lone symbol is coded with one bit
+        entry->length = length ? length : 1;
+    }
+}
 
-    // ======== WRITE HEADER INFORMATION ========
 
-    // write symbol size
-    fwrite(&symbol_size, sizeof(int), 1, output);
+void CollectLengths(tree_node_t *node, unsigned char *lengths, int depth){
+    if (!node->left && !node->right){
+        lengths[node->symbol] = depth;
+        return;
+    }
+    CollectLengths(node->left, lengths, depth + 1);
+    CollectLengths(node->right, lengths, depth + 1);
+}
 
-    // write symbols count
-    int count = 0;
-    for (int i = 0; i < symbol_range; i++){
+
+void BuildCodeLengths(int symbol_count, int *frequency, int max_length, unsigned char *lengths){
+    int *scaled = malloc(symbol_count * sizeof(int));
+    memcpy(scaled, frequency, symbol_count * sizeof(int));
+
+    int used = 0;
+    for (int i = 0; i < symbol_count; i++){
         if (frequency[i]){
+            used++;
+        }
+    }
+
+    while (1){
+        memset(lengths, 0, symbol_count);
+        if (used == 0){
+            break;
+        }
+        // a lone symbol still needs one bit
+        if (used == 1){
+            for (int i = 0; i < symbol_count; i++){
+                if (frequency[i]){
+                    lengths[i] = 1;
+                }
+            }
+            break;
+        }
+
+        tree_node_t *tree = BuildHuffmanTree(symbol_count, scaled);
+        CollectLengths(tree, lengths, 0);
+        FreeHuffmanTree(tree);
+
+        int longest = 0;
+        for (int i = 0; i < symbol_count; i++){
+            if (lengths[i] > longest){
+                longest = lengths[i];
+            }
+        }
+        if (longest <= max_length){
+            break;
+        }
+        // flatten the distribution until the tree fits the limit
+        for (int i = 0; i < symbol_count; i++){
+            if (scaled[i]){
+                scaled[i] = (scaled[i] + 1) / 2;
+            }
+        }
+    }
+    free(scaled);
+}
+
+
+// assign canonical codes (shorter codes first, then by symbol) from code lengths
+void BuildCanonicalCodes(int symbol_count, unsigned char *lengths, unsigned int *bits){
+    int length_count[33] = {0};
+    for (int i = 0; i < symbol_count; i++){
+        length_count[lengths[i]]++;
+    }
+    length_count[0] = 0;
+
+    unsigned int next_code[33];
+    unsigned int code = 0;
+    for (int length = 1; length <= 32; length++){
+        code = (code + length_count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+
+    for (int i = 0; i < symbol_count; i++){
+        if (lengths[i]){
+            bits[i] = next_code[lengths[i]]++;
+        }
+    }
+}
+
+
+// length-limited canonical codes (no strings, bits and length only)
+void BuildCanonicalHuffmanCodes(int symbol_count, int *frequency, huffman_code_t *codes){
+    unsigned char *lengths = malloc(symbol_count);
+    unsigned int *bits = calloc(symbol_count, sizeof(unsigned int));
+    BuildCodeLengths(symbol_count, frequency, CANONICAL_CODE_BITS, lengths);
+    BuildCanonicalCodes(symbol_count, lengths, bits);
+    for (int i = 0; i < symbol_count; i++){
+        codes[i].code[0] = '\0';
+        codes[i].length = lengths[i];
+        codes[i].bits = bits[i];
+    }
+    free(lengths);
+    free(bits);
+}
+
+
+// decoding tree of canonical codes, NULL if there are no symbols
+tree_node_t* BuildCanonicalTree(int symbol_count, unsigned char *lengths){
+    unsigned int *bits = calloc(symbol_count, sizeof(unsigned int));
+    BuildCanonicalCodes(symbol_count, lengths, bits);
+
+    tree_node_t *root = NULL;
+    for (int i = 0; i < symbol_count; i++){
+        if (!lengths[i]){
+            continue;
+        }
+        if (!root){
+            root = calloc(1, sizeof(tree_node_t));
+            root->symbol = -1;
+        }
+        tree_node_t *node = root;
+        for (int depth = lengths[i] - 1; depth >= 0; depth--){
+            tree_node_t **child = (bits[i] >> depth & 1) ? &node->right : &node->left;
+            if (!*child){
+                *child = calloc(1, sizeof(tree_node_t));
+                (*child)->symbol = -1;
+            }
+            node = *child;
+        }
+        node->symbol = i;
+    }
+    free(bits);
+    return root;
+}
+
+
+void PutVarint(unsigned char *buffer, size_t *pos, unsigned int value){
+    while (value >= 0x80){
+        buffer[(*pos)++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buffer[(*pos)++] = value;
+}
+
+
+// returns 0 on success, -1 if the buffer ends first
+int GetVarint(unsigned char *buffer, size_t size, size_t *pos, unsigned int *value){
+    *value = 0;
+    for (int shift = 0; shift < 32; shift += 7){
+        if (*pos >= size){
+            return -1;
+        }
+        unsigned char byte = buffer[(*pos)++];
+        *value |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)){
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// MSB-first bit packing into a zeroed buffer
+void PackBits(unsigned char *buffer, size_t *bit_pos, unsigned int bits, int length){
+    for (int i = length - 1; i >= 0; i--){
+        if (bits >> i & 1){
+            buffer[*bit_pos / 8] |= 0x80 >> (*bit_pos % 8);
+        }
+        (*bit_pos)++;
+    }
+}
+
+
+int UnpackBit(unsigned char *buffer, size_t size, size_t *bit_pos){
+    if (*bit_pos / 8 >= size){
+        return -1;
+    }
+    int bit = buffer[*bit_pos / 8] >> (7 - *bit_pos % 8) & 1;
+    (*bit_pos)++;
+    return bit;
+}
+
+
+/*
+ * compact symbol table of the 16-bit mode:
+ *   uint32 size of the rest of the table
+ *   varint number of symbols
+ *   byte 0: 8192 byte bitmap of present symbols, 1: varint deltas between present symbols
+ *   16 bytes: lengths (1-15) of the canonical code of code lengths 1-32, two per byte
+ *   code lengths of present symbols with that code, padded to a byte
+ *   trailing byte, if TRAILING_BYTE is set
+ */
+void WriteSparseHeader(FILE *output, huffman_code_t *codes, int trailing){
+    int count = 0;
+    size_t deltas_size = 0;
+    int last = -1;
+    int length_frequency[CANONICAL_CODE_BITS + 1] = {0};
+    unsigned char delta_buffer[5];
+    for (int i = 0; i < 65536; i++){
+        if (codes[i].length){
+            size_t pos = 0;
+            PutVarint(delta_buffer, &pos, i - last - 1);
+            deltas_size += pos;
+            last = i;
             count++;
+            length_frequency[codes[i].length]++;
         }
     }
-    fwrite(&count, sizeof(int), 1, output);
-    
-    // write symbol-frequency pairs
-    for (int i = 0; i < symbol_range; i++){
-        if (frequency[i]){
-            fwrite(&i, sizeof(int), 1, output);
-            fwrite(&frequency[i], sizeof(int), 1, output);
+
+    size_t capacity = 16 + 8192 + 16 + 65536 * 2 + (65536 * LENGTH_CODE_BITS + 7) / 8;
+    unsigned char *table = calloc(capacity, 1);
+    size_t pos = 0;
+    PutVarint(table, &pos, count);
+    if (count){
+        int bitmap = deltas_size > 8192;
+        table[pos++] = bitmap ? 0 : 1;
+        last = -1;
+        for (int i = 0; i < 65536; i++){
+            if (codes[i].length){
+                if (bitmap){
+                    table[pos + i / 8] |= 1 << (i % 8);
+                } else{
+                    PutVarint(table, &pos, i - last - 1);
+                }
+                last = i;
+            }
+        }
+        if (bitmap){
+            pos += 8192;
+        }
+
+        // canonical code of the code lengths
+        unsigned char length_lengths[CANONICAL_CODE_BITS + 1];
+        unsigned int length_bits[CANONICAL_CODE_BITS + 1];
+        BuildCodeLengths(CANONICAL_CODE_BITS + 1, length_frequency, LENGTH_CODE_BITS, length_lengths);
+        BuildCanonicalCodes(CANONICAL_CODE_BITS + 1, length_lengths, length_bits);
+        for (int i = 1; i <= CANONICAL_CODE_BITS; i += 2){
+            table[pos++] = length_lengths[i] << 4 | length_lengths[i + 1];
         }
+
+        size_t bit_pos = pos * 8;
+        for (int i = 0; i < 65536; i++){
+            if (codes[i].length){
+                int length = codes[i].length;
+                PackBits(table, &bit_pos, length_bits[length], length_lengths[length]);
+            }
+        }
+        pos = (bit_pos + 7) / 8;
+    }
+    if (trailing != -1){
+        table[pos++] = trailing;
     }
 
+    uint32_t table_size = pos;
+    fwrite(&table_size, sizeof(uint32_t), 1, output);
+    fwrite(table, 1, pos, output);
+    free(table);
+}
 
-    // ======== CALC TOTAL BIT COUNT ========
 
-    rewind(input); // reset file position
-    long bit_count = 0;
+// fills lengths[65536] and trailing (-1 if none), returns -1 on a malformed table
+int ReadSparseHeader(byte_source_t *input, int flags, unsigned char *lengths, int *trailing){
+    uint32_t table_size;
+    if (ReadSource(input, &table_size, sizeof(uint32_t)) != sizeof(uint32_t) || table_size > 1 << 20){
+        return -1;
+    }
+    // the whole table in one read
+    unsigned char *table = malloc(table_size ? table_size : 1);
+    if (ReadSource(input, table, table_size) != table_size){
+        free(table);
+        return -1;
+    }
 
-    // for 8-bit symbols
-    if (symbol_size == 8){
-        int c;
-        while ((c = fgetc(input)) != EOF){
-            bit_count += codes[c].length;
+    int result = -1;
+    size_t pos = 0;
+    unsigned int count;
+    memset(lengths, 0, 65536);
+    *trailing = -1;
+    if (GetVarint(table, table_size, &pos, &count) || count > 65536){
+        goto done;
+    }
+
+    if (count){
+        // present symbols, marked with length 1 for now
+        if (pos >= table_size){
+            goto done;
         }
-    // for 16-bit symbols
+        // 0: bitmap, 1: delta-coded list
+        int kind = table[pos++];
+        unsigned int found = 0;
+        if (kind > 1){
+            goto done;
+        }
+        if (kind == 0){
+            if (table_size - pos < 8192){
+                goto done;
+            }
+            for (int i = 0; i < 65536; i++){
+                if (table[pos + i / 8] >> (i % 8) & 1){
+                    lengths[i] = 1;
+                    found++;
+                }
+            }
+            pos += 8192;
+        } else{
+            long symbol = -1;
+            for (unsigned int i = 0; i < count; i++){
+                unsigned int delta;
+                if (GetVarint(table, table_size, &pos, &delta)){
+                    goto done;
+                }
+                symbol += (long)delta + 1;
+                if (symbol > 65535){
+                    goto done;
+                }
+                lengths[symbol] = 1;
+                found++;
+            }
+        }
+        if (found != count || table_size - pos < 16){
+            goto done;
+        }
+
+        unsigned char length_lengths[CANONICAL_CODE_BITS + 1] = {0};
+        for (int i = 1; i <= CANONICAL_CODE_BITS; i += 2){
+            length_lengths[i] = table[pos] >> 4;
+            length_lengths[i + 1] = table[pos] & 15;
+            pos++;
+        }
+        tree_node_t *length_tree = BuildCanonicalTree(CANONICAL_CODE_BITS + 1, length_lengths);
+        if (!length_tree){
+            goto done;
+        }
+
+        // code lengths follow in symbol order
+        size_t bit_pos = pos * 8;
+        uint64_t kraft = 0;
+        for (int i = 0; i < 65536 && kraft <= 1ull << CANONICAL_CODE_BITS; i++){
+            if (!lengths[i]){
+                continue;
+            }
+            tree_node_t *node = length_tree;
+            while (node && (node->left || node->right)){
+                int bit = UnpackBit(table, table_size, &bit_pos);
+                node = bit < 0 ? NULL : bit ? node->right : node->left;
+            }
+            if (!node){
+                kraft = UINT64_MAX;
+                break;
+            }
+            lengths[i] = node->symbol;
+            kraft += 1ull << (CANONICAL_CODE_BITS - node->symbol);
+        }
+        FreeHuffmanTree(length_tree);
+        // codes must be complete (a lone symbol has a 1-bit code)
+        if (count == 1 ? kraft != 1ull << (CANONICAL_CODE_BITS - 1) : kraft != 1ull << CANONICAL_CODE_BITS){
+            goto done;
+        }
+        pos = (bit_pos + 7) / 8;
+    }
+
+    if (flags & TRAILING_BYTE){
+        if (pos >= table_size){
+            goto done;
+        }
+        *trailing = table[pos++];
+    }
+    result = 0;
+
+done:
+    free(table);
+    return result;
+}
+
+
+// trailing: odd last byte of a 16-bit stream, -1 if none
+void CompressTree(FILE *input, FILE *output, huffman_code_t *codes, int symbol_size, int *frequency, int trailing){
+    int flags = symbol_size; // header flags are kept in the symbol size field
+    int transform = symbol_size >> TRANSFORM_SHIFT & TRANSFORM_MASK;
+    symbol_size &= SYMBOL_SIZE_MASK;
+    int symbol_range = symbol_size == 8 ? 256 : 65536;
+
+    if (symbol_size == 16){
+        if (trailing != -1){
+            flags |= TRAILING_BYTE;
+        }
+        // codes from BuildCanonicalHuffmanCodes, only their lengths are stored
+        flags |= SPARSE_HEADER;
+    }
+
+    // ======== WRITE HEADER INFORMATION ========
+
+    // write symbol size
+    fwrite(&flags, sizeof(int), 1, output);
+
+    if (flags & SPARSE_HEADER){
+        WriteSparseHeader(output, codes, trailing);
     } else{
-        uint16_t symbol;
-        while (fread(&symbol, 2, 1, input)){
-            bit_count += codes[symbol].length;
+        // write symbols count
+        int count = 0;
+        for (int i = 0; i < symbol_range; i++){
+            if (frequency[i]){
+                count++;
+            }
         }
+        fwrite(&count, sizeof(int), 1, output);
+        
+        // write symbol-frequency pairs
+        for (int i = 0; i < symbol_range; i++){
+            if (frequency[i]){
+                fwrite(&i, sizeof(int), 1, output);
+                fwrite(&frequency[i], sizeof(int), 1, output);
+            }
+        }
+        if (trailing != -1){
+            fputc(trailing, output);
+        }
+    }
+
+
+    // ======== CALC TOTAL BIT COUNT ========
+
+    long bit_count = 0;
+    for (int i = 0; i < symbol_range; i++){
+        bit_count += (long)frequency[i] * codes[i].length;
     }
     // write total bit count
     fwrite(&bit_count, sizeof(long), 1, output);
@@ -173,51 +600,233 @@ void CompressTree(FILE *input, FILE *output, huffman_code_t *codes, int symbol_s
 
     // ======== COMPRESSION ========
 
-    rewind(input);
-    int bit_pos = 0; // current bit position in buffer
-    unsigned char buffer = 0; // bit buffer
-
-    // for 8-bit symbols
-    if (symbol_size == 8){
-        int c;
-        while ((c = fgetc(input)) != EOF){
-            for (int i = 0; codes[c].code[i]; i++){
-                buffer <<= 1; // free space
-                if (codes[c].code[i] == '1'){
-                    buffer |= 1; // set bit 
-                }
-                // if buffer full then write to file
-                if (++bit_pos == 8){
-                    fputc(buffer, output);
-                    bit_pos = 0;
-                    buffer = 0;
-                }
+    transform_state_t reader;
+    InitTransformReader(&reader, transform, symbol_size, input);
+    bit_writer_t writer;
+    InitBitWriter(&writer, output);
+    unsigned char chunk[CODER_CHUNK_SIZE];
+    size_t size;
+    while ((size = ReadTransformed(&reader, chunk, sizeof(chunk)))){
+        kernels.encode_symbols(&writer, chunk, size, symbol_size, codes);
+        AdvanceProgress(size);
+    }
+    // write remaining bits
+    FlushBits(&writer);
+}
+
+
+// bits needed to code the histogram with its own order-0 model
+double HistogramCost(int *histogram){
+    double total = 0;
+    double cost = 0;
+    for (int i = 0; i < 256; i++){
+        if (histogram[i]){
+            total += histogram[i];
+            cost -= histogram[i] * log2(histogram[i]);
+        }
+    }
+    return total ? cost + total * log2(total) : 0;
+}
+
+
+double MergedCost(int *a, int *b){
+    int merged[256];
+    for (int i = 0; i < 256; i++){
+        merged[i] = a[i] + b[i];
+    }
+    return HistogramCost(merged);
+}
+
+
+// greedily merge contexts with similar histograms, returns number of tables
+int ClusterContexts(int *histograms, unsigned char *context_map){
+    int *cluster = malloc(256 * 256 * sizeof(int));
+    memcpy(cluster, histograms, 256 * 256 * sizeof(int));
+    double *delta = malloc(256 * 256 * sizeof(double));
+    double cost[256];
+    int cluster_of[256];
+    int active[256];
+    int active_count = 0;
+
+    // every non-empty context starts as its own cluster
+    for (int ctx = 0; ctx < 256; ctx++){
+        cluster_of[ctx] = -1;
+        for (int i = 0; i < 256; i++){
+            if (histograms[ctx * 256 + i]){
+                cluster_of[ctx] = ctx;
+                active[active_count++] = ctx;
+                cost[ctx] = HistogramCost(&cluster[ctx * 256]);
+                break;
             }
-        } 
-    // for 16-bit symbols
-    } else{
-        uint16_t symbol;
-        while (fread(&symbol, 2, 1, input)){
-            for (int i = 0; codes[symbol].code[i]; i++){
-                buffer <<= 1;
-                if (codes[symbol].code[i] == '1'){
-                    buffer |= 1;
+        }
+    }
+
+    // cost increase of merging two clusters
+    for (int i = 0; i < active_count; i++){
+        for (int j = i + 1; j < active_count; j++){
+            int a = active[i];
+            int b = active[j];
+            delta[a * 256 + b] = MergedCost(&cluster[a * 256], &cluster[b * 256]) - cost[a] - cost[b];
+            delta[b * 256 + a] = delta[a * 256 + b];
+        }
+    }
+
+    while (active_count > 1){
+        int best_i = 0;
+        int best_j = 1;
+        for (int i = 0; i < active_count; i++){
+            for (int j = i + 1; j < active_count; j++){
+                if (delta[active[i] * 256 + active[j]] < delta[active[best_i] * 256 + active[best_j]]){
+                    best_i = i;
+                    best_j = j;
                 }
-                if (++bit_pos == 8){
-                    fputc(buffer, output);
-                    bit_pos = 0;
-                    buffer = 0;
+            }
+        }
+        int a = active[best_i];
+        int b = active[best_j];
+
+        // stop when a separate table pays for its header
+        if (active_count <= CONTEXT_TABLES_MAX && delta[a * 256 + b] >= CONTEXT_TABLE_COST){
+            break;
+        }
+
+        // merge b into a
+        for (int i = 0; i < 256; i++){
+            cluster[a * 256 + i] += cluster[b * 256 + i];
+        }
+        cost[a] = HistogramCost(&cluster[a * 256]);
+        for (int ctx = 0; ctx < 256; ctx++){
+            if (cluster_of[ctx] == b){
+                cluster_of[ctx] = a;
+            }
+        }
+        active[best_j] = active[--active_count];
+
+        for (int i = 0; i < active_count; i++){
+            int c = active[i];
+            if (c != a){
+                delta[a * 256 + c] = MergedCost(&cluster[a * 256], &cluster[c * 256]) - cost[a] - cost[c];
+                delta[c * 256 + a] = delta[a * 256 + c];
+            }
+        }
+    }
+
+    // number the tables, empty contexts go to the first one
+    int table_of[256];
+    for (int i = 0; i < active_count; i++){
+        table_of[active[i]] = i;
+    }
+    for (int ctx = 0; ctx < 256; ctx++){
+        context_map[ctx] = cluster_of[ctx] < 0 ? 0 : table_of[cluster_of[ctx]];
+    }
+
+    free(cluster);
+    free(delta);
+    return active_count ? active_count : 1;
+}
+
+
+void CompressContextTree(FILE *input, FILE *output, int symbol_size){
+    // ======== PER-CONTEXT HISTOGRAMS ========
+
+    // context is the previous byte (0 for the first one)
+    double start = PhaseClock();
+    int transform = symbol_size >> TRANSFORM_SHIFT & TRANSFORM_MASK;
+    int *histograms = calloc(256 * 256, sizeof(int));
+    transform_state_t reader;
+    InitTransformReader(&reader, transform, 8, input);
+    unsigned char chunk[CODER_CHUNK_SIZE];
+    size_t size;
+    int prev = 0;
+    while ((size = ReadTransformed(&reader, chunk, sizeof(chunk)))){
+        for (size_t i = 0; i < size; i++){
+            histograms[prev * 256 + chunk[i]]++;
+            prev = chunk[i];
+        }
+        AdvanceProgress(size);
+    }
+
+    unsigned char context_map[256];
+    int table_count = ClusterContexts(histograms, context_map);
+
+    // one length-limited canonical code per table
+    unsigned char *lengths = calloc(table_count * 256, 1);
+    unsigned int *bits = calloc(table_count * 256, sizeof(unsigned int));
+    int merged[256];
+    for (int t = 0; t < table_count; t++){
+        memset(merged, 0, sizeof(merged));
+        for (int ctx = 0; ctx < 256; ctx++){
+            if (context_map[ctx] == t){
+                for (int i = 0; i < 256; i++){
+                    merged[i] += histograms[ctx * 256 + i];
                 }
             }
         }
-        
+        BuildCodeLengths(256, merged, CONTEXT_CODE_BITS, &lengths[t * 256]);
+        BuildCanonicalCodes(256, &lengths[t * 256], &bits[t * 256]);
     }
 
-    // write remaining bits
-    if (bit_pos > 0){
-        buffer <<= (8 - bit_pos);
-        fputc(buffer, output);
+
+    AddPhaseTime(PHASE_ANALYZE, start);
+    start = PhaseClock();
+
+
+    // ======== WRITE HEADER INFORMATION ========
+
+    fwrite(&symbol_size, sizeof(int), 1, output);
+    fputc(table_count, output);
+    fwrite(context_map, 1, 256, output);
+    // code lengths, two per byte
+    for (int i = 0; i < table_count * 256; i += 2){
+        fputc(lengths[i] << 4 | lengths[i + 1], output);
+    }
+
+    long bit_count = 0;
+    for (int ctx = 0; ctx < 256; ctx++){
+        for (int i = 0; i < 256; i++){
+            bit_count += (long)histograms[ctx * 256 + i] * lengths[context_map[ctx] * 256 + i];
+        }
     }
+    fwrite(&bit_count, sizeof(long), 1, output);
+
+
+    // ======== COMPRESSION ========
+
+    InitTransformReader(&reader, transform, 8, input);
+    bit_writer_t writer;
+    InitBitWriter(&writer, output);
+    prev = 0;
+    while ((size = ReadTransformed(&reader, chunk, sizeof(chunk)))){
+        kernels.encode_context(&writer, chunk, size, &prev, context_map, bits, lengths);
+        AdvanceProgress(size);
+    }
+    FlushBits(&writer);
+    AddPhaseTime(PHASE_ENCODE, start);
+
+    free(histograms);
+    free(lengths);
+    free(bits);
+}
+
+
+// bytes between the current position and the end of the input, -1 if unknown
+long RemainingBytes(byte_source_t *input){
+    long buffered = input->size - input->pos;
+    if (!input->file){
+        return buffered;
+    }
+    struct stat st;
+    if (fstat(fileno(input->file), &st) != 0){
+        return -1;
+    }
+    return st.st_size - ftell(input->file) + buffered;
+}
+
+
+// bit count of a stream must fit into the rest of the input
+int ValidBitCount(byte_source_t *input, long bit_count){
+    long remaining = RemainingBytes(input);
+    return bit_count >= 0 && (remaining < 0 || bit_count <= remaining * 8);
 }
 
 
@@ -236,49 +845,237 @@ void FreeHuffmanCodes(huffman_code_t *codes, int symbol_count){
 }
 
 
-void DecompressTree(FILE *input, FILE *output){
-    int symbol_size;
-    fread(&symbol_size, sizeof(int), 1, input);
-    int symbol_range = symbol_size == 8 ? 256 : 65536;
+// returns 0 on success, -1 on a malformed stream
+int DecompressContextTree(byte_source_t *input, transform_state_t *output){
+    int table_count = GetSourceByte(input);
+    unsigned char context_map[256];
+    if (table_count < 1 || table_count > CONTEXT_TABLES_MAX || ReadSource(input, context_map, 256) != 256){
+        return -1;
+    }
+    for (int ctx = 0; ctx < 256; ctx++){
+        if (context_map[ctx] >= table_count){
+            return -1;
+        }
+    }
 
-    int count;
-    fread(&count, sizeof(int), 1, input);
+    unsigned char packed[CONTEXT_TABLES_MAX * 128];
+    if (ReadSource(input, packed, table_count * 128) != (size_t)table_count * 128){
+        return -1;
+    }
+    unsigned char *lengths = malloc(table_count * 256);
+    for (int i = 0; i < table_count * 256; i += 2){
+        lengths[i] = packed[i / 2] >> 4;
+        lengths[i + 1] = packed[i / 2] & 15;
+    }
 
-    int *frequency = calloc(symbol_range, sizeof(int));
-    for (int i = 0; i < count; i++){
-        int s, f;
-        fread(&s, sizeof(int), 1, input);
-        fread(&f, sizeof(int), 1, input);
-        frequency[s] = f;
+    // every table must fit the lookup: lengths in range and no oversubscribed code
+    for (int t = 0; t < table_count; t++){
+        long kraft = 0;
+        for (int s = 0; s < 256; s++){
+            int length = lengths[t * 256 + s];
+            if (length > CONTEXT_CODE_BITS){
+                free(lengths);
+                return -1;
+            }
+            if (length){
+                kraft += 1 << (CONTEXT_CODE_BITS - length);
+            }
+        }
+        if (kraft > 1 << CONTEXT_CODE_BITS){
+            free(lengths);
+            return -1;
+        }
     }
 
     long bit_count;
-    fread(&bit_count, sizeof(long), 1, input);
-
-
-    tree_node_t *tree = BuildHuffmanTree(symbol_range, frequency);
-    tree_node_t *node = tree; // = root
-    int byte;
-    long read_bit = 0;
-    while ((byte = fgetc(input)) != EOF && read_bit < bit_count){
-        for (int i = 7; i >= 0 && read_bit < bit_count; i--, read_bit++){
-            int bit = (byte >> i) & 1;
-            node = bit ? node->right : node->left; // if 1 then right, 0 - left
-            // if leaf
-            if (!node->left && !node->right){
-                if (symbol_size == 8){
-                    fputc((uint8_t)node->symbol, output);
-                } else{
-                    uint16_t symbol = (uint16_t)node->symbol;
-                    fwrite(&symbol, 2, 1, output);
-                }
-                node = tree; // reset the current node pointer back to the root for the next symbol (prefix codes)
+    if (ReadSource(input, &bit_count, sizeof(long)) != sizeof(long) || !ValidBitCount(input, bit_count)){
+        free(lengths);
+        return -1;
+    }
+
+    // direct lookup tables: next CONTEXT_CODE_BITS bits -> (symbol << 4 | code length)
+    context_decoder_t decoder;
+    decoder.tables = calloc((size_t)table_count << CONTEXT_CODE_BITS, sizeof(uint16_t));
+    memcpy(decoder.context_map, context_map, 256);
+    decoder.prev = 0;
+    decoder.bit_count = bit_count;
+    decoder.read_bit = 0;
+    unsigned int bits[256];
+    for (int t = 0; t < table_count; t++){
+        BuildCanonicalCodes(256, &lengths[t * 256], bits);
+        uint16_t *table = &decoder.tables[t << CONTEXT_CODE_BITS];
+        for (int s = 0; s < 256; s++){
+            int length = lengths[t * 256 + s];
+            if (!length){
+                continue;
+            }
+            int shift = CONTEXT_CODE_BITS - length;
+            for (unsigned int k = bits[s] << shift; k < (bits[s] + 1) << shift; k++){
+                table[k] = s << 4 | length;
+            }
+        }
+    }
+
+    bit_reader_t reader;
+    InitBitReader(&reader, input);
+    unsigned char out[CODER_CHUNK_SIZE];
+    size_t out_count;
+    long done = 0;
+    while ((out_count = kernels.decode_context(&reader, &decoder, out, sizeof(out)))){
+        WriteTransformed(output, out, out_count);
+        AdvanceProgress(decoder.read_bit / 8 - done);
+        done = decoder.read_bit / 8;
+    }
+
+    free(lengths);
+    free(decoder.tables);
+    return decoder.read_bit == bit_count ? 0 : -1;
+}
+
+
+// returns 0 on success, -1 on a malformed stream
+int DecompressSymbols(byte_source_t *input, transform_state_t *output, int symbol_size){
+    int trailing = -1;
+    int flags = symbol_size;
+    symbol_size &= SYMBOL_SIZE_MASK;
+    int symbol_range = symbol_size == 8 ? 256 : 65536;
+
+    tree_node_t *tree;
+    int *frequency = NULL;
+    if (flags & SPARSE_HEADER){
+        unsigned char *lengths = malloc(65536);
+        if (ReadSparseHeader(input, flags, lengths, &trailing) != 0){
+            free(lengths);
+            return -1;
+        }
+        tree = BuildCanonicalTree(65536, lengths);
+        free(lengths);
+    } else{
+        int count;
+        if (ReadSource(input, &count, sizeof(int)) != sizeof(int) || count < 0 || count > symbol_range){
+            return -1;
+        }
+
+        frequency = calloc(symbol_range, sizeof(int));
+        for (int i = 0; i < count; i++){
+            int s, f;
+            if (ReadSource(input, &s, sizeof(int)) != sizeof(int) || ReadSource(input, &f, sizeof(int)) != sizeof(int) ||
+            s < 0 || s >= symbol_range || f <= 0){
+                free(frequency);
+                return -1;
+            }
+            frequency[s] = f;
+        }
+        if (flags & TRAILING_BYTE){
+            trailing = GetSourceByte(input);
+            if (trailing == EOF){
+                free(frequency);
+                return -1;
             }
         }
+        tree = BuildHuffmanTree(symbol_range, frequency);
+    }
+
+    long bit_count;
+    if (ReadSource(input, &bit_count, sizeof(long)) != sizeof(long) || !ValidBitCount(input, bit_count) || (!tree && bit_count)){
+        FreeHuffmanTree(tree);
+        free(frequency);
+        return -1;
     }
 
+    huffman_decoder_t *decoder = malloc(sizeof(huffman_decoder_t));
+    if (tree){
+        BuildDecodeTable(tree, decoder->table);
+    }
+    decoder->symbol_size = symbol_size;
+    decoder->bit_count = bit_count;
+    decoder->read_bit = 0;
+
+    bit_reader_t reader;
+    InitBitReader(&reader, input);
+    unsigned char out[CODER_CHUNK_SIZE];
+    size_t out_count;
+    long done = 0;
+    while ((out_count = kernels.decode_symbols(&reader, decoder, out, sizeof(out)))){
+        WriteTransformed(output, out, out_count);
+        AdvanceProgress(decoder->read_bit / 8 - done);
+        done = decoder->read_bit / 8;
+    }
+    if (trailing != -1){
+        unsigned char byte = trailing;
+        WriteTransformed(output, &byte, 1);
+    }
+
+    int result = decoder->read_bit == bit_count ? 0 : -1;
     FreeHuffmanTree(tree);
+    free(decoder);
     free(frequency);
+    return result;
+}
+
+
+// returns 0 on success, -1 on a malformed stream
+int DecompressSource(byte_source_t *input, FILE *output){
+    int symbol_size;
+    if (ReadSource(input, &symbol_size, sizeof(int)) != sizeof(int)){
+        return -1;
+    }
+
+    // reject unknown sizes, flags and transforms
+    int known_flags = SYMBOL_SIZE_MASK | CONTEXT_MODE | TRAILING_BYTE | SPARSE_HEADER | TRANSFORM_MASK << TRANSFORM_SHIFT;
+    int size = symbol_size & SYMBOL_SIZE_MASK;
+    int transform = symbol_size >> TRANSFORM_SHIFT & TRANSFORM_MASK;
+    if ((symbol_size & ~known_flags) || (size != 8 && size != 16) || transform >= TRANSFORM_COUNT ||
+    (symbol_size & CONTEXT_MODE && (size != 8 || symbol_size & (TRAILING_BYTE | SPARSE_HEADER))) ||
+    (size == 8 && symbol_size & (TRAILING_BYTE | SPARSE_HEADER))){
+        return -1;
+    }
+
+    // decoded chunks go through the inverse transform on their way out
+    transform_state_t writer;
+    InitTransformWriter(&writer, transform, output);
+
+    double start = PhaseClock();
+    int result;
+    if (symbol_size & CONTEXT_MODE){
+        result = DecompressContextTree(input, &writer);
+    } else{
+        result = DecompressSymbols(input, &writer, symbol_size);
+    }
+    FinishTransformed(&writer);
+    AddPhaseTime(PHASE_DECODE, start);
+    return result;
 }
 
 
+int DecompressTree(FILE *input, FILE *output){
+    byte_source_t source;
+    InitFileSource(&source, input);
+    return DecompressSource(&source, output);
+}
+
+
+// upper bound of the decoded size of a stream held in memory: every code is at
+// least one bit and a zero run pair expands to at most 256 bytes. -1 if the
+// stream is too short to have a header
+long MaxDecodedSize(const unsigned char *data, size_t size){
+    int flags;
+    if (size < sizeof(int)){
+        return -1;
+    }
+    memcpy(&flags, data, sizeof(int));
+    int transform = flags >> TRANSFORM_SHIFT & TRANSFORM_MASK;
+    long bound = (long)size * 8 * ((flags & SYMBOL_SIZE_MASK) == 16 ? 2 : 1) + 1;
+    if (transform == TRANSFORM_RLE || transform == TRANSFORM_MTF){
+        bound *= 128;
+    }
+    return bound;
+}
+
+
+// decode a stream held in memory (e.g. a mapped archive member)
+int DecompressMemory(const unsigned char *data, size_t size, FILE *output){
+    byte_source_t source;
+    InitMemorySource(&source, data, size);
+    return DecompressSource(&source, output);
+}
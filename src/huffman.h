@@ -2,10 +2,35 @@
 #define HUFFMAN_H
 
 #include <stdio.h>
+#include <stdint.h>
 
 // maximum number of symbols (256 for 8 bit, 65536 for 16 bit)
 #define SYMBOLS_MAX_NUM 65536
 
+// header flag or'ed into the symbol size field: order-1 context modeling (8-bit symbols only)
+#define CONTEXT_MODE 0x100
+// header flag: 16-bit symbols with an odd input length, the last byte follows the symbol table
+#define TRAILING_BYTE 0x200
+// header flag: 16-bit symbols with a compact table (present symbols + entropy-coded code lengths)
+#define SPARSE_HEADER 0x400
+#define SYMBOL_SIZE_MASK 0xff
+// bits 16-23 of the symbol size field hold the transform (see transform.h)
+
+// code length limit of context tables (every table is a direct lookup of that many bits)
+#define CONTEXT_CODE_BITS 12
+// maximum number of tables after context clustering
+#define CONTEXT_TABLES_MAX 16
+
+// code length limit of canonical codes
+#define CANONICAL_CODE_BITS 32
+// code length limit of the code that compresses code lengths
+#define LENGTH_CODE_BITS 15
+
+// bits resolved by one lookup in the order-0 decode table
+#define DECODE_TABLE_BITS 11
+// size of the chunks read by the encoders (even, so 16-bit symbols never straddle chunks)
+#define CODER_CHUNK_SIZE 65536
+
 
 typedef struct tree_node_t {
     int symbol;
@@ -18,13 +43,47 @@ typedef struct tree_node_t {
 typedef struct huffman_code_t {
     char code[256];
     int length;
+    uint64_t bits; // same code as an integer
 } huffman_code_t;
 
 
+// decode table entry: a symbol or, for longer codes, the node to continue from
+typedef struct decode_entry_t {
+    tree_node_t *node;
+    int symbol;
+    int length;
+} decode_entry_t;
+
+
+typedef struct huffman_decoder_t {
+    decode_entry_t table[1 << DECODE_TABLE_BITS];
+    int symbol_size;
+    long bit_count;
+    long read_bit;
+} huffman_decoder_t;
+
+
+typedef struct context_decoder_t {
+    uint16_t *tables; // per table: next CONTEXT_CODE_BITS bits -> (symbol << 4 | code length)
+    unsigned char context_map[256];
+    int prev;
+    long bit_count;
+    long read_bit;
+} context_decoder_t;
+
+
 tree_node_t* BuildHuffmanTree(int symbol_count, int *frequency);
 void BuildCodes(tree_node_t *node, huffman_code_t *codes, char *code, int depth);
-void CompressTree(FILE *input, FILE *output, huffman_code_t *codes, int symbol_size, int *frequency);
-void DecompressTree(FILE *input, FILE *output);
+void BuildDecodeTable(tree_node_t *tree, decode_entry_t *table);
+void BuildCodeLengths(int symbol_count, int *frequency, int max_length, unsigned char *lengths);
+void BuildCanonicalCodes(int symbol_count, unsigned char *lengths, unsigned int *bits);
+void BuildCanonicalHuffmanCodes(int symbol_count, int *frequency, huffman_code_t *codes);
+tree_node_t* BuildCanonicalTree(int symbol_count, unsigned char *lengths);
+void CompressTree(FILE *input, FILE *output, huffman_code_t *codes, int symbol_size, int *frequency, int trailing);
+void CompressContextTree(FILE *input, FILE *output, int symbol_size);
+int DecompressTree(FILE *input, FILE *output);
+long MaxDecodedSize(const unsigned char *data, size_t size);
+int DecompressMemory(const unsigned char *data, size_t size, FILE *output);
 void FreeHuffmanTree(tree_node_t *tree);
 void FreeHuffmanCodes(huffman_code_t *codes, int symbol_count);
 
@@ -0,0 +1,96 @@
+#include "kernels.h"
+#include <stdio.h>
+#include <string.h>
+
+// other architectures only get the portable kernels
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+
+// portable C (baseline SSE2 on x86-64)
+#define KERNEL(name) name##Generic
+#include "kernels_impl.h"
+#undef KERNEL
+
+#ifdef KERNELS_X86
+// same source as generic, the compiler may use SSE4.2/POPCNT instructions
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+#define KERNEL(name) name##Sse42
+#include "kernels_impl.h"
+#undef KERNEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi,bmi2,lzcnt,popcnt")
+#define KERNEL(name) name##Avx2
+#define KERNEL_BMI2
+#include "kernels_impl.h"
+#undef KERNEL_BMI2
+#undef KERNEL
+#pragma GCC pop_options
+#endif
+
+
+#define KERNELS(suffix, label) { \
+    label, \
+    Histogram8##suffix, \
+    Histogram16##suffix, \
+    EncodeSymbols##suffix, \
+    EncodeContext##suffix, \
+    DecodeSymbols##suffix, \
+    DecodeContext##suffix, \
+}
+
+static kernels_t variants[] = {
+    KERNELS(Generic, "generic"),
+#ifdef KERNELS_X86
+    KERNELS(Sse42, "sse42"),
+    KERNELS(Avx2, "avx2"),
+#endif
+};
+
+kernels_t kernels = KERNELS(Generic, "generic");
+
+
+int CpuSupports(int variant){
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (variant == 1){
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+    }
+    if (variant == 2){
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2");
+    }
+#endif
+    return variant == 0;
+}
+
+
+// pick kernels by name, or the best supported ones for NULL. returns 0 on success
+int SelectKernels(char *name){
+    int count = sizeof(variants) / sizeof(variants[0]);
+    if (!name){
+        for (int i = count - 1; i >= 0; i--){
+            if (CpuSupports(i)){
+                kernels = variants[i];
+                return 0;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++){
+        if (strcmp(name, variants[i].name) == 0){
+            if (!CpuSupports(i)){
+                fprintf(stderr, "Error: CPU does not support '%s' kernels.\n", name);
+                return -1;
+            }
+            kernels = variants[i];
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: Unknown CPU kernels '%s'.\n", name);
+    return -1;
+}
@@ -0,0 +1,27 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bitio.h"
+#include "huffman.h"
+
+
+// hot loops of the coder, compiled once per instruction set
+typedef struct kernels_t {
+    char *name;
+    void (*histogram8)(const unsigned char *data, size_t size, int *frequency);
+    void (*histogram16)(const unsigned char *data, size_t size, int *frequency);
+    void (*encode_symbols)(bit_writer_t *writer, const unsigned char *data, size_t size, int symbol_size, huffman_code_t *codes);
+    void (*encode_context)(bit_writer_t *writer, const unsigned char *data, size_t size, int *prev, unsigned char *context_map, unsigned int *bits, unsigned char *lengths);
+    size_t (*decode_symbols)(bit_reader_t *reader, huffman_decoder_t *decoder, unsigned char *out, size_t capacity);
+    size_t (*decode_context)(bit_reader_t *reader, context_decoder_t *decoder, unsigned char *out, size_t capacity);
+} kernels_t;
+
+
+// kernels in use (generic until SelectKernels is called)
+extern kernels_t kernels;
+
+int SelectKernels(char *name);
+
+#endif
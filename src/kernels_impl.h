@@ -0,0 +1,135 @@
+// kernel bodies, included by kernels.c once per instruction set with
+// KERNEL(name) set to the variant's function name (no include guard)
+
+#ifdef KERNEL_BMI2
+// shrx + bzhi
+#define PEEK_BITS(reader, n) ((uint32_t)_bzhi_u64((reader)->buffer >> ((reader)->bit_count - (n)), (n)))
+#else
+#define PEEK_BITS(reader, n) PeekBits(reader, n)
+#endif
+
+
+void KERNEL(Histogram8)(const unsigned char *data, size_t size, int *frequency){
+    // 4 tables, so that runs of one byte do not stall on the same counter
+    int counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4){
+        counts[0][data[i]]++;
+        counts[1][data[i + 1]]++;
+        counts[2][data[i + 2]]++;
+        counts[3][data[i + 3]]++;
+    }
+    for (; i < size; i++){
+        counts[0][data[i]]++;
+    }
+    for (int s = 0; s < 256; s++){
+        frequency[s] += counts[0][s] + counts[1][s] + counts[2][s] + counts[3][s];
+    }
+}
+
+
+// size in bytes, a trailing odd byte is ignored
+void KERNEL(Histogram16)(const unsigned char *data, size_t size, int *frequency){
+    for (size_t i = 0; i + 2 <= size; i += 2){
+        uint16_t symbol;
+        memcpy(&symbol, &data[i], 2);
+        frequency[symbol]++;
+    }
+}
+
+
+void KERNEL(EncodeSymbols)(bit_writer_t *writer, const unsigned char *data, size_t size, int symbol_size, huffman_code_t *codes){
+    if (symbol_size == 8){
+        for (size_t i = 0; i < size; i++){
+            huffman_code_t *code = &codes[data[i]];
+            PutLongBits(writer, code->bits, code->length);
+        }
+    } else{
+        for (size_t i = 0; i + 2 <= size; i += 2){
+            uint16_t symbol;
+            memcpy(&symbol, &data[i], 2);
+            PutLongBits(writer, codes[symbol].bits, codes[symbol].length);
+        }
+    }
+}
+
+
+void KERNEL(EncodeContext)(bit_writer_t *writer, const unsigned char *data, size_t size, int *prev, unsigned char *context_map, unsigned int *bits, unsigned char *lengths){
+    int context = *prev;
+    for (size_t i = 0; i < size; i++){
+        int code = context_map[context] * 256 + data[i];
+        PutBits(writer, bits[code], lengths[code]);
+        context = data[i];
+    }
+    *prev = context;
+}
+
+
+// decode until the bit count is reached or out is full, returns bytes written
+size_t KERNEL(DecodeSymbols)(bit_reader_t *reader, huffman_decoder_t *decoder, unsigned char *out, size_t capacity){
+    size_t count = 0;
+    size_t step = decoder->symbol_size / 8;
+    long read_bit = decoder->read_bit;
+    while (read_bit < decoder->bit_count && count + step <= capacity){
+        RefillBits(reader);
+        decode_entry_t *entry = &decoder->table[PEEK_BITS(reader, DECODE_TABLE_BITS)];
+        int symbol = entry->symbol;
+        if (symbol < 0 && !entry->node){
+            read_bit = decoder->bit_count + 1; // not a valid code: stop past the end
+            break;
+        }
+        SkipBits(reader, entry->length);
+        read_bit += entry->length;
+
+        // long code: walk the rest of the tree
+        if (entry->node){
+            tree_node_t *node = entry->node;
+            while (node->left || node->right){
+                if (!reader->bit_count){
+                    RefillBits(reader);
+                }
+                node = PEEK_BITS(reader, 1) ? node->right : node->left;
+                SkipBits(reader, 1);
+                read_bit++;
+            }
+            symbol = node->symbol;
+        }
+
+        if (step == 1){
+            out[count++] = (unsigned char)symbol;
+        } else{
+            uint16_t word = (uint16_t)symbol;
+            memcpy(&out[count], &word, 2);
+            count += 2;
+        }
+    }
+    decoder->read_bit = read_bit;
+    return count;
+}
+
+
+size_t KERNEL(DecodeContext)(bit_reader_t *reader, context_decoder_t *decoder, unsigned char *out, size_t capacity){
+    size_t count = 0;
+    int prev = decoder->prev;
+    long read_bit = decoder->read_bit;
+    while (read_bit < decoder->bit_count && count < capacity){
+        RefillBits(reader);
+        uint16_t entry = decoder->tables[(decoder->context_map[prev] << CONTEXT_CODE_BITS) | PEEK_BITS(reader, CONTEXT_CODE_BITS)];
+        int length = entry & 15;
+        if (!length){
+            read_bit = decoder->bit_count + 1; // not a valid code: stop past the end
+            break;
+        }
+        SkipBits(reader, length);
+        read_bit += length;
+        prev = entry >> 4;
+        out[count++] = prev;
+    }
+    decoder->prev = prev;
+    decoder->read_bit = read_bit;
+    return count;
+}
+
+
+#undef PEEK_BITS
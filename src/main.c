@@ -1,8 +1,12 @@
 #include "huffman.h"
 #include "utils.h"
+#include "transform.h"
+#include "kernels.h"
+#include "stats.h"
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
 
 // help
 void PrintHelp(char *program_name){
@@ -12,6 +16,13 @@ void PrintHelp(char *program_name){
     printf(" -d, --decompress       Decompress input files/direcrory.\n");
     printf(" -1, --8bit             Use 8-bit symbols (default).\n");
     printf(" -2, --16bit            Use 16-bit symbols.\n");
+    printf(" -x, --context          Use order-1 context modeling (8-bit symbols).\n");
+    printf(" -t, --transform=NAME   Preprocess input: none (default), rle, delta, mtf, auto.\n");
+    printf("     --cpu=NAME         Force kernels: generic, sse42, avx2 (default: detected).\n");
+    printf(" -j, --jobs=N           Extract archive members on N threads (default: one per CPU).\n");
+    printf(" -q, --quiet            Do not print per-file messages.\n");
+    printf("     --progress         Print progress, throughput and ETA to stderr.\n");
+    printf("     --stats[=FORMAT]   Print totals and per-phase CPU time: text (default), json.\n");
     printf(" -h, --help             Display that information.\n");
 }
 
@@ -33,6 +44,15 @@ int main(int argc, char *argv[]){
     enum Mode operation = COMPRESS;
     // default symbol size: 8 bit
     int symbol_size = 8;
+    // order-1 context modeling
+    int context = 0;
+    // preprocessing transform
+    int transform = TRANSFORM_NONE;
+    // kernels override
+    char *cpu = NULL;
+    // instrumentation
+    int progress = 0;
+    int stats_format = STATS_NONE;
     // for multi-file archive 
     char *output_name = NULL;
 
@@ -42,13 +62,20 @@ int main(int argc, char *argv[]){
         {"decompress", no_argument, 0, 'd'},
         {"8bit", no_argument, 0, '1'},
         {"16bit", no_argument, 0, '2'},
+        {"context", no_argument, 0, 'x'},
+        {"transform", required_argument, 0, 't'},
+        {"cpu", required_argument, 0, 'C'},
+        {"jobs", required_argument, 0, 'j'},
+        {"quiet", no_argument, 0, 'q'},
+        {"progress", no_argument, 0, 'P'},
+        {"stats", optional_argument, 0, 'S'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0},
     }; 
 
     // flags
     int opt;
-    while ((opt = getopt_long(argc, argv, "cd12ho", long_options, NULL)) != -1){
+    while ((opt = getopt_long(argc, argv, "cd12xt:j:qho", long_options, NULL)) != -1){
         switch (opt){
         case 'c':
             operation = COMPRESS;
@@ -62,6 +89,42 @@ int main(int argc, char *argv[]){
         case '2':
             symbol_size = 16;
             break;
+        case 'x':
+            context = 1;
+            break;
+        case 't':
+            transform = ParseTransform(optarg);
+            if (transform < 0){
+                fprintf(stderr, "Error: Unknown transform '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'C':
+            cpu = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs <= 0){
+                fprintf(stderr, "Error: Invalid number of jobs '%s'.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'P':
+            progress = 1;
+            break;
+        case 'S':
+            if (!optarg || strcmp(optarg, "text") == 0){
+                stats_format = STATS_TEXT;
+            } else if (strcmp(optarg, "json") == 0){
+                stats_format = STATS_JSON;
+            } else{
+                fprintf(stderr, "Error: Unknown stats format '%s'.\n", optarg);
+                return 1;
+            }
+            break;
         case 'h':
             PrintHelp(argv[0]);
             return 0;
@@ -70,11 +133,27 @@ int main(int argc, char *argv[]){
             return 1;
         }
     }
-   
+
+    if (SelectKernels(cpu) != 0){
+        return 1;
+    }
+
+    if (context){
+        if (symbol_size != 8){
+            fprintf(stderr, "Error: Context modeling supports only 8-bit symbols.\n");
+            return 1;
+        }
+        symbol_size |= CONTEXT_MODE;
+    }
+    symbol_size |= transform << TRANSFORM_SHIFT;
 
     // input dir/file 
     char *input[256];
     int file_count = 0;
+    if (argc - optind > 256){
+        fprintf(stderr, "Error: Too many input files (at most 256).\n");
+        return 1;
+    }
     for (int i = optind; i < argc; i++)
         input[file_count++] = argv[i];
 
@@ -83,8 +162,17 @@ int main(int argc, char *argv[]){
         fprintf(stderr, "Error: Missing input file/directory.\n");
         return 1;
     }
-    
 
+    // compression reads the input twice (histogram and encode)
+    StartStats(progress, operation == COMPRESS ? 2 : 1);
+    for (int i = 0; i < file_count; i++){
+        long bytes = 0;
+        int files = 0;
+        CountInput(input[i], &bytes, &files);
+        AddStatsTotal(bytes, files);
+    }
+
+    int result = 0;
     if (operation == COMPRESS){
         if (file_count == 1){
             if (IsDir(input[0])){    
@@ -94,47 +182,23 @@ int main(int argc, char *argv[]){
             }
         } else {
             char *archive = "archive.huff";
-            CompressFilesToArchive(input, file_count, archive, symbol_size);
+            result = CompressFilesToArchive(input, file_count, archive, symbol_size);
         }
     } else if (operation == DECOMPRESS){
         if (IsDir(input[0])){
-            DecompressDir(input[0]);
+            result = DecompressDir(input[0]);
         } else {
-            FILE *file = fopen(input[0], "rb");
-
             // ? archive or file 
-            fseek(file, 0, SEEK_END);
-            long file_size = ftell(file);
-            rewind(file);
-
-            int maybe_file_count = 0;
-            if (fread(&maybe_file_count, sizeof(int), 1, file) == 1 && sizeof(int) + maybe_file_count * sizeof(file_index_t) < file_size){
-                file_index_t *maybe_index = malloc(maybe_file_count * sizeof(file_index_t));
-                fread(maybe_index, sizeof(file_index_t), maybe_file_count, file);
-                int valid = 1;
-                for (int i = 0; i < maybe_file_count; i++){
-                    if (maybe_index[i].position <= 0 || maybe_index[i].position > file_size || 
-                    maybe_index[i].length <= 0 || 
-                    maybe_index[i].position + maybe_index[i].length > file_size){
-                        valid = 0;
-                        break;
-                    }
-                }
-                free(maybe_index);
-                fseek(file, 0, SEEK_SET);
-
-                if (valid){
-                    fclose(file);
-                    DecompressArchive(input[0]);
-                    return 0;
-                }
+            result = DecompressArchive(input[0]);
+            if (result > 0){
+                result = DecompressFile(input[0]);
             }
-            fclose(file);
-            DecompressFile(input[0]);
         }
     }
 
-    return 0;
+    PrintStats(stats_format);
+    // corrupted input must be visible to callers
+    return result ? 1 : 0;
 }
 
 
@@ -0,0 +1,154 @@
+#include "stats.h"
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+stats_t stats;
+
+// archive members are extracted on several threads: totals and progress
+// output are shared, the current file's progress is per thread
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread long file_done;
+// CPU time this thread already added to phases
+static __thread double counted;
+
+static char *phase_names[PHASE_COUNT] = {"analyze", "transform", "encode", "decode"};
+
+
+double WallTime(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// CPU time of the calling thread
+double CpuTime(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+void StartStats(int progress, int passes){
+    stats = (stats_t){0};
+    stats.progress = progress;
+    stats.passes = passes;
+    stats.start_time = WallTime();
+    stats.last_progress = stats.start_time;
+}
+
+
+void AddStatsTotal(long bytes, int files){
+    stats.total_bytes += bytes;
+    stats.total_files += files;
+}
+
+
+// bytes that belong to no file, e.g. the archive header and index
+void AddStatsBytes(long bytes_in, long bytes_out){
+    pthread_mutex_lock(&stats_lock);
+    stats.bytes_in += bytes_in;
+    stats.bytes_out += bytes_out;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+// CPU time not yet added to a phase: a phase timed inside another one
+// (the transform inside the coder loops) is not counted twice
+double PhaseClock(void){
+    return CpuTime() - counted;
+}
+
+
+// add CPU time since start (taken with PhaseClock) to the phase
+void AddPhaseTime(int phase, double start){
+    double time = PhaseClock() - start;
+    counted += time;
+    pthread_mutex_lock(&stats_lock);
+    stats.phase_time[phase] += time;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+// caller holds stats_lock
+void PrintProgress(double now){
+    // input bytes through all passes, so that speed and ETA are per input byte
+    double done = __atomic_load_n(&stats.done_bytes, __ATOMIC_RELAXED) / (double)stats.passes;
+    double elapsed = now - stats.start_time;
+    double speed = elapsed > 0 ? done / elapsed : 0;
+    double percent = stats.total_bytes ? 100.0 * done / stats.total_bytes : 100.0;
+    fprintf(stderr, "\r[%5.1f%%] %d/%d files, %.1f MB/s", percent, stats.files_done, stats.total_files, speed / 1e6);
+    if (speed > 0 && done < stats.total_bytes){
+        long eta = (long)((stats.total_bytes - done) / speed);
+        fprintf(stderr, ", ETA %02ld:%02ld   ", eta / 60, eta % 60);
+    } else{
+        fprintf(stderr, "              ");
+    }
+    stats.last_progress = now;
+}
+
+
+// called by the coders for every processed chunk of input
+void AdvanceProgress(long bytes){
+    __atomic_add_fetch(&stats.done_bytes, bytes, __ATOMIC_RELAXED);
+    file_done += bytes;
+    // another thread printing now is as good as printing here
+    if (stats.progress && pthread_mutex_trylock(&stats_lock) == 0){
+        double now = WallTime();
+        if (now - stats.last_progress >= PROGRESS_INTERVAL){
+            PrintProgress(now);
+        }
+        pthread_mutex_unlock(&stats_lock);
+    }
+}
+
+
+void StartFile(void){
+    file_done = 0;
+}
+
+
+void FinishFile(long bytes_in, long bytes_out){
+    // chunks of transformed data do not add up to the input size
+    __atomic_add_fetch(&stats.done_bytes, bytes_in * stats.passes - file_done, __ATOMIC_RELAXED);
+    file_done = bytes_in * stats.passes;
+    pthread_mutex_lock(&stats_lock);
+    stats.bytes_in += bytes_in;
+    stats.bytes_out += bytes_out;
+    stats.files_done++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+void PrintStats(int format){
+    double now = WallTime();
+    if (stats.progress){
+        PrintProgress(now);
+        fprintf(stderr, "\n");
+    }
+
+    double wall = now - stats.start_time;
+    double cpu = 0;
+    for (int i = 0; i < PHASE_COUNT; i++){
+        cpu += stats.phase_time[i];
+    }
+    double speed = wall > 0 ? stats.bytes_in / wall / 1e6 : 0;
+
+    if (format == STATS_JSON){
+        printf("{\"files\": %d, \"bytes_in\": %ld, \"bytes_out\": %ld, ", stats.files_done, stats.bytes_in, stats.bytes_out);
+        printf("\"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"mb_per_second\": %.3f, \"phases\": {", wall, cpu, speed);
+        for (int i = 0; i < PHASE_COUNT; i++){
+            printf("%s\"%s\": %.6f", i ? ", " : "", phase_names[i], stats.phase_time[i]);
+        }
+        printf("}}\n");
+    } else if (format == STATS_TEXT){
+        printf("Files: %d\n", stats.files_done);
+        printf("Bytes in: %ld\n", stats.bytes_in);
+        printf("Bytes out: %ld\n", stats.bytes_out);
+        printf("Time: %.3f s (%.1f MB/s)\n", wall, speed);
+        for (int i = 0; i < PHASE_COUNT; i++){
+            printf("CPU %s: %.3f s\n", phase_names[i], stats.phase_time[i]);
+        }
+    }
+}
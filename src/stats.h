@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+// phases with separately measured CPU time
+enum Phase{
+    PHASE_ANALYZE, // histograms, trees, tables
+    PHASE_TRANSFORM,
+    PHASE_ENCODE,
+    PHASE_DECODE,
+    PHASE_COUNT
+};
+
+// --stats output format
+enum StatsFormat{
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON
+};
+
+// seconds between two progress lines
+#define PROGRESS_INTERVAL 0.5
+
+
+typedef struct stats_t {
+    long bytes_in;
+    long bytes_out;
+    long total_bytes; // expected input for progress/ETA
+    long done_bytes; // input processed so far, summed over passes
+    int passes; // reads of every input byte (compression: histogram and encode)
+    int files_done;
+    int total_files;
+    double phase_time[PHASE_COUNT];
+    double start_time;
+    double last_progress;
+    int progress; // print progress to stderr
+} stats_t;
+
+
+extern stats_t stats;
+
+double WallTime(void);
+double CpuTime(void);
+double PhaseClock(void);
+void StartStats(int progress, int passes);
+void AddStatsTotal(long bytes, int files);
+void AddStatsBytes(long bytes_in, long bytes_out);
+void AddPhaseTime(int phase, double start);
+void AdvanceProgress(long bytes);
+void StartFile(void);
+void FinishFile(long bytes_in, long bytes_out);
+void PrintStats(int format);
+
+#endif
@@ -0,0 +1,313 @@
+#include "transform.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+
+int ParseTransform(char *name){
+    if (strcmp(name, "none") == 0){
+        return TRANSFORM_NONE;
+    }
+    if (strcmp(name, "rle") == 0){
+        return TRANSFORM_RLE;
+    }
+    if (strcmp(name, "delta") == 0){
+        return TRANSFORM_DELTA;
+    }
+    if (strcmp(name, "mtf") == 0){
+        return TRANSFORM_MTF;
+    }
+    if (strcmp(name, "auto") == 0){
+        return TRANSFORM_AUTO;
+    }
+    return -1;
+}
+
+
+void InitTransform(transform_state_t *state, int transform, FILE *output){
+    state->transform = transform;
+    state->input = NULL;
+    state->output = output;
+    state->histogram = NULL;
+    state->symbol_size = 8;
+    state->done = 0;
+    state->carry = -1;
+    state->run = 0;
+    state->half = 0;
+    state->low = 0;
+    state->sample_half = 0;
+    state->sample_low = 0;
+    state->previous = 0;
+    for (int i = 0; i < 256; i++){
+        state->order[i] = i;
+    }
+    state->out = state->buffer;
+    state->count = 0;
+}
+
+
+void Emit(transform_state_t *state, unsigned char byte){
+    // sampling: count output symbols
+    if (state->histogram){
+        if (state->symbol_size == 8){
+            state->histogram[byte]++;
+        } else if (state->sample_half){
+            state->histogram[state->sample_low | byte << 8]++;
+            state->sample_half = 0;
+        } else{
+            state->sample_low = byte;
+            state->sample_half = 1;
+        }
+        return;
+    }
+
+    state->out[state->count++] = byte;
+    if (state->output && state->count == TRANSFORM_BUFFER_SIZE){
+        fwrite(state->buffer, 1, state->count, state->output);
+        state->count = 0;
+    }
+}
+
+
+void FlushTransform(transform_state_t *state){
+    if (state->transform != TRANSFORM_DELTA && state->run){
+        // pending zero run
+        Emit(state, 0);
+        Emit(state, state->run - 1);
+        state->run = 0;
+    }
+    if (state->transform == TRANSFORM_DELTA && state->half){
+        // odd trailing byte is kept as is
+        Emit(state, state->low);
+        state->half = 0;
+    }
+    if (state->output){
+        fwrite(state->buffer, 1, state->count, state->output);
+        state->count = 0;
+    }
+}
+
+
+void RleEncode(transform_state_t *state, unsigned char byte){
+    if (!byte){
+        if (++state->run == 256){
+            Emit(state, 0);
+            Emit(state, 255);
+            state->run = 0;
+        }
+        return;
+    }
+    if (state->run){
+        Emit(state, 0);
+        Emit(state, state->run - 1);
+        state->run = 0;
+    }
+    Emit(state, byte);
+}
+
+
+void MtfDecode(transform_state_t *state, unsigned char index){
+    unsigned char byte = state->order[index];
+    memmove(&state->order[1], &state->order[0], index);
+    state->order[0] = byte;
+    Emit(state, byte);
+}
+
+
+void EmitDecoded(transform_state_t *state, unsigned char byte){
+    if (state->transform == TRANSFORM_MTF){
+        MtfDecode(state, byte);
+    } else{
+        Emit(state, byte);
+    }
+}
+
+
+void ForwardByte(transform_state_t *state, unsigned char byte){
+    if (state->transform == TRANSFORM_RLE){
+        RleEncode(state, byte);
+    } else if (state->transform == TRANSFORM_MTF){
+        int index = (unsigned char *)memchr(state->order, byte, 256) - state->order;
+        memmove(&state->order[1], &state->order[0], index);
+        state->order[0] = byte;
+        RleEncode(state, index);
+    } else if (state->transform == TRANSFORM_DELTA){
+        if (!state->half){
+            state->low = byte;
+            state->half = 1;
+            return;
+        }
+        unsigned int word = state->low | byte << 8;
+        unsigned int delta = (word - state->previous) & 0xffff;
+        state->previous = word;
+        state->half = 0;
+        Emit(state, delta & 0xff);
+        Emit(state, delta >> 8);
+    } else{
+        Emit(state, byte);
+    }
+}
+
+
+void InverseByte(transform_state_t *state, unsigned char byte){
+    if (state->transform == TRANSFORM_RLE || state->transform == TRANSFORM_MTF){
+        // byte after a zero marker is the run length - 1
+        if (state->run){
+            for (int i = 0; i <= byte; i++){
+                EmitDecoded(state, 0);
+            }
+            state->run = 0;
+        } else if (!byte){
+            state->run = 1;
+        } else{
+            EmitDecoded(state, byte);
+        }
+    } else if (state->transform == TRANSFORM_DELTA){
+        if (!state->half){
+            state->low = byte;
+            state->half = 1;
+            return;
+        }
+        unsigned int word = ((state->low | byte << 8) + state->previous) & 0xffff;
+        state->previous = word;
+        state->half = 0;
+        Emit(state, word & 0xff);
+        Emit(state, word >> 8);
+    } else{
+        Emit(state, byte);
+    }
+}
+
+
+// coders read the input through the forward transform, a chunk at a time
+void InitTransformReader(transform_state_t *state, int transform, int symbol_size, FILE *input){
+    InitTransform(state, transform, NULL);
+    state->input = input;
+    state->symbol_size = symbol_size;
+    rewind(input);
+}
+
+
+// fill out with the next transformed bytes, returns 0 at the end of the input.
+// 16-bit chunks are even except for the last one
+size_t ReadTransformed(transform_state_t *state, unsigned char *out, size_t capacity){
+    if (state->transform == TRANSFORM_NONE){
+        return fread(out, 1, capacity, state->input);
+    }
+
+    double start = PhaseClock();
+    unsigned char chunk[TRANSFORM_BUFFER_SIZE];
+    state->out = out;
+    state->count = 0;
+    if (state->carry >= 0){
+        out[state->count++] = state->carry;
+        state->carry = -1;
+    }
+    // an input byte yields at most 2 output bytes, plus a pending run
+    while (!state->done && state->count + 2 * sizeof(chunk) + 4 <= capacity){
+        size_t size = fread(chunk, 1, sizeof(chunk), state->input);
+        if (!size){
+            FlushTransform(state);
+            state->done = 1;
+            break;
+        }
+        for (size_t i = 0; i < size; i++){
+            ForwardByte(state, chunk[i]);
+        }
+    }
+    if (state->symbol_size == 16 && state->count % 2 && !state->done){
+        state->carry = out[--state->count];
+    }
+    AddPhaseTime(PHASE_TRANSFORM, start);
+    return state->count;
+}
+
+
+// decoders write their output through the inverse transform
+void InitTransformWriter(transform_state_t *state, int transform, FILE *output){
+    InitTransform(state, transform, output);
+}
+
+
+void WriteTransformed(transform_state_t *state, const unsigned char *data, size_t size){
+    if (state->transform == TRANSFORM_NONE){
+        fwrite(data, 1, size, state->output);
+        return;
+    }
+    double start = PhaseClock();
+    for (size_t i = 0; i < size; i++){
+        InverseByte(state, data[i]);
+    }
+    AddPhaseTime(PHASE_TRANSFORM, start);
+}
+
+
+void FinishTransformed(transform_state_t *state){
+    // an odd trailing delta byte was stored as is
+    if (state->transform == TRANSFORM_DELTA && state->half){
+        Emit(state, state->low);
+        state->half = 0;
+    }
+    fwrite(state->buffer, 1, state->count, state->output);
+    state->count = 0;
+}
+
+
+// estimated huffman size in bits of the transformed sample
+double SampleCost(FILE *input, int transform, int symbol_size, int *histogram){
+    int symbol_range = symbol_size == 8 ? 256 : 65536;
+    memset(histogram, 0, symbol_range * sizeof(int));
+
+    transform_state_t state;
+    InitTransform(&state, transform, NULL);
+    state.histogram = histogram;
+    state.symbol_size = symbol_size;
+
+    rewind(input);
+    unsigned char chunk[TRANSFORM_BUFFER_SIZE];
+    size_t total = 0;
+    size_t size;
+    while (total < TRANSFORM_SAMPLE_SIZE && (size = fread(chunk, 1, sizeof(chunk), input))){
+        for (size_t i = 0; i < size; i++){
+            ForwardByte(&state, chunk[i]);
+        }
+        total += size;
+    }
+    FlushTransform(&state);
+
+    double count = 0;
+    for (int i = 0; i < symbol_range; i++){
+        count += histogram[i];
+    }
+    // huffman codes are at least 1 bit long
+    double cost = 0;
+    for (int i = 0; i < symbol_range; i++){
+        if (histogram[i]){
+            double bits = log2(count / histogram[i]);
+            cost += histogram[i] * (bits < 1 ? 1 : bits);
+        }
+    }
+    return cost;
+}
+
+
+// pick the transform with the smallest estimated size on a sample of the input
+int ChooseTransform(FILE *input, int symbol_size){
+    int *histogram = malloc(65536 * sizeof(int));
+    int best = TRANSFORM_NONE;
+    double best_cost = SampleCost(input, TRANSFORM_NONE, symbol_size, histogram);
+    for (int transform = TRANSFORM_NONE + 1; transform < TRANSFORM_COUNT; transform++){
+        double cost = SampleCost(input, transform, symbol_size, histogram);
+        // a transform has to save at least 3% to pay for its pass
+        if (cost < best_cost * 0.97){
+            best = transform;
+            best_cost = cost;
+        }
+    }
+    free(histogram);
+    rewind(input);
+    return best;
+}
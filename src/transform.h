@@ -0,0 +1,52 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdio.h>
+
+// transforms applied to the input before coding, stored in the symbol size field
+#define TRANSFORM_NONE 0
+#define TRANSFORM_RLE 1 // zero runs -> (0, run length - 1)
+#define TRANSFORM_DELTA 2 // 16-bit little-endian words -> difference to previous word
+#define TRANSFORM_MTF 3 // move-to-front followed by zero run RLE
+#define TRANSFORM_COUNT 4
+// command line only: pick the cheapest transform for every stream
+#define TRANSFORM_AUTO 0xff
+
+#define TRANSFORM_SHIFT 16
+#define TRANSFORM_MASK 0xff
+
+// how much of the input ChooseTransform looks at
+#define TRANSFORM_SAMPLE_SIZE (256 * 1024)
+#define TRANSFORM_BUFFER_SIZE 4096
+
+
+typedef struct transform_state_t {
+    int transform;
+    FILE *input; // ReadTransformed: untransformed input
+    FILE *output; // WriteTransformed: restored output
+    int *histogram; // when set, output symbols are counted instead of written
+    int symbol_size;
+    int done; // input exhausted and flushed
+    int carry; // byte held back to keep 16-bit chunks even, -1 if none
+    int run; // pending zero run (forward) or zero marker seen (inverse)
+    int half; // delta: a low byte is pending
+    unsigned char low;
+    int sample_half; // 16-bit histogram: a low byte is pending
+    unsigned char sample_low;
+    unsigned int previous;
+    unsigned char order[256]; // move-to-front list
+    unsigned char *out; // where Emit writes, buffer unless reading
+    size_t count;
+    unsigned char buffer[TRANSFORM_BUFFER_SIZE];
+} transform_state_t;
+
+
+int ParseTransform(char *name);
+void InitTransformReader(transform_state_t *state, int transform, int symbol_size, FILE *input);
+size_t ReadTransformed(transform_state_t *state, unsigned char *out, size_t capacity);
+void InitTransformWriter(transform_state_t *state, int transform, FILE *output);
+void WriteTransformed(transform_state_t *state, const unsigned char *data, size_t size);
+void FinishTransformed(transform_state_t *state);
+int ChooseTransform(FILE *input, int symbol_size);
+
+#endif
@@ -1,12 +1,24 @@
+#define _GNU_SOURCE // fallocate
 #include "utils.h"
 #include "huffman.h"
+#include "transform.h"
+#include "kernels.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <pthread.h>
+
+// silence per-file messages
+int quiet = 0;
+// threads for archive extraction, 0 for one per CPU
+int jobs = 0;
 
 
 int IsDir(char *path){
@@ -31,6 +43,100 @@ long GetFileSize(char *path){
 }
 
 
+// order-0 coding of one stream
+void CompressStreamSymbols(FILE *input, FILE *output, int symbol_size){
+    // count symbol frequencies
+    double start = PhaseClock();
+    int symbol_count = (symbol_size & SYMBOL_SIZE_MASK) == 8 ? 256 : 65536;
+    int *frequency = calloc(symbol_count, sizeof(int));
+    transform_state_t reader;
+    InitTransformReader(&reader, symbol_size >> TRANSFORM_SHIFT & TRANSFORM_MASK, symbol_size & SYMBOL_SIZE_MASK, input);
+    unsigned char chunk[CODER_CHUNK_SIZE];
+    size_t size;
+    long total = 0;
+    int last = -1;
+    while ((size = ReadTransformed(&reader, chunk, sizeof(chunk)))){
+        if (symbol_count == 256){
+            kernels.histogram8(chunk, size, frequency);
+        } else {
+            kernels.histogram16(chunk, size, frequency);
+        }
+        AdvanceProgress(size);
+        total += size;
+        last = chunk[size - 1];
+    }
+    // 16-bit symbols: an odd last byte is stored in the header
+    int trailing = symbol_count == 65536 && total % 2 ? last : -1;
+
+    // build huffman tree and codes
+    tree_node_t *tree = NULL;
+    huffman_code_t *codes = calloc(symbol_count, sizeof(huffman_code_t));
+    if (symbol_count == 256){
+        tree = BuildHuffmanTree(symbol_count, frequency);
+        char code[256]; // temporary buffer for codes
+        if (tree){
+            BuildCodes(tree, codes, code, 0);
+        }
+    } else {
+        // only code lengths are stored for 16-bit symbols, so the codes are canonical
+        BuildCanonicalHuffmanCodes(symbol_count, frequency, codes);
+    }
+    AddPhaseTime(PHASE_ANALYZE, start);
+
+    start = PhaseClock();
+    CompressTree(input, output, codes, symbol_size, frequency, trailing);
+    AddPhaseTime(PHASE_ENCODE, start);
+
+    FreeHuffmanTree(tree);
+    FreeHuffmanCodes(codes, symbol_count);
+    free(frequency);
+}
+
+
+// compress one stream (symbol size may carry CONTEXT_MODE and a transform)
+void CompressStream(FILE *input, FILE *output, int symbol_size){
+    int transform = symbol_size >> TRANSFORM_SHIFT & TRANSFORM_MASK;
+    if (transform == TRANSFORM_AUTO){
+        double start = PhaseClock();
+        transform = ChooseTransform(input, symbol_size & SYMBOL_SIZE_MASK);
+        AddPhaseTime(PHASE_ANALYZE, start);
+    }
+    // the coders read the input through the transform
+    symbol_size = (symbol_size & ~(TRANSFORM_MASK << TRANSFORM_SHIFT)) | transform << TRANSFORM_SHIFT;
+
+    if (symbol_size & CONTEXT_MODE){
+        CompressContextTree(input, output, symbol_size);
+    } else{
+        CompressStreamSymbols(input, output, symbol_size);
+    }
+}
+
+
+// input bytes and files of a path for progress reporting
+void CountInput(char *path, long *bytes, int *files){
+    if (!IsDir(path)){
+        *bytes += GetFileSize(path);
+        *files += 1;
+        return;
+    }
+    DIR *dir = opendir(path);
+    if (!dir){
+        return;
+    }
+    struct dirent *file;
+    while ((file = readdir(dir))){
+        char file_path[512];
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, file->d_name);
+        struct stat st;
+        if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode)){
+            *bytes += st.st_size;
+            *files += 1;
+        }
+    }
+    closedir(dir);
+}
+
+
 void CompressFile(char *path, int symbol_size){
     int ouput_len = strlen(path) + 6;
     char *output_path = malloc(strlen(path) + 6); // ".huff" + '\0'
@@ -51,54 +157,31 @@ void CompressFileTo(char *input_path, char *output_path, int symbol_size){
     if (!output){
         fprintf(stderr, "Failed to open output file.\n");
         fclose(input);
-        free(output_path);
         return;
     }
 
-    // count symbol frequencies
-    int symbol_count = symbol_size == 8 ? 256 : 65536;
-    int *frequency = calloc(symbol_count, sizeof(int));
-    if (symbol_size == 8){
-        int c;
-        while((c = fgetc(input)) != EOF){
-            frequency[c]++;
-        } 
-    } else {
-        uint16_t symbol;
-        while((fread(&symbol, 2, 1, input))){
-            frequency[symbol]++;
-        }
-    }
-
-    rewind(input);
-
-    // build huffman tree and codes
-    tree_node_t *tree = BuildHuffmanTree(symbol_count, frequency);
-    huffman_code_t *codes = calloc(symbol_count, sizeof(huffman_code_t));
-
-    char code[256]; // temporary buffer for codes
-    BuildCodes(tree, codes, code, 0);
-
     // perform copression
-    printf("Compressing %s -> %s\n", input_path, output_path);
-    CompressTree(input, output, codes, symbol_size, frequency);
+    if (!quiet){
+        printf("Compressing %s -> %s\n", input_path, output_path);
+    }
+    StartFile();
+    CompressStream(input, output, symbol_size);
 
     // get file sizes
     long input_size = GetFileSize(input_path);
     fclose(input);
     fclose(output);
     long output_size = GetFileSize(output_path);
-    printf("Input size: %ld bytes\n", input_size);
-    printf("Compressed size: %ld bytes\n", output_size);
-    printf("Compression ratio: %.2f%%\n\n", 100.0 * output_size / input_size);
-   
-    FreeHuffmanTree(tree);
-    FreeHuffmanCodes(codes, symbol_count);
-    free(frequency);
+    FinishFile(input_size, output_size);
+    if (!quiet){
+        printf("Input size: %ld bytes\n", input_size);
+        printf("Compressed size: %ld bytes\n", output_size);
+        printf("Compression ratio: %.2f%%\n\n", 100.0 * output_size / input_size);
+    }
 }
 
 
-void DecompressFile(char *path){
+int DecompressFile(char *path){
     int output_len = strlen(path) + 6;
     char *output_path = malloc(output_len); // ".huff" + '\0'
     strncpy(output_path, path, output_len);
@@ -109,42 +192,85 @@ void DecompressFile(char *path){
         *dot = '\0';
     }
 
-    DecompressFileTo(path, output_path);
+    int result = DecompressFileTo(path, output_path);
     free(output_path);
+    return result;
 }
 
 
-void DecompressFileTo(char *input_path, char *output_path){
+// returns 0 on success, -1 on failure (the output of a corrupted stream is removed)
+int DecompressFileTo(char *input_path, char *output_path){
     FILE *input = fopen(input_path, "rb");
     if (!input){
         fprintf(stderr, "Failed to open compressed file.\n");
-        return;
+        return -1;
     }
 
     FILE *output = fopen(output_path, "wb");
     if (!output){
         fprintf(stderr, "Failed to open output file.\n");
         fclose(input);
-        free(output_path);
-        return;
+        return -1;
     }
 
-    printf("Decompressing %s -> %s\n", input_path, output_path);
-    DecompressTree(input, output);
+    if (!quiet){
+        printf("Decompressing %s -> %s\n", input_path, output_path);
+    }
+    StartFile();
+    int result = DecompressTree(input, output);
+    FinishFile(GetFileSize(input_path), ftell(output));
     fclose(input);
     fclose(output);
-    
+    if (result != 0){
+        fprintf(stderr, "Corrupted input: %s\n", input_path);
+        remove(output_path);
+    }
+    return result;
 }
 
 
-void CompressFilesToArchive(char **files, int file_count, char *archive_name, int symbol_size){
+// member name for a path, the way tar stores it: no leading '/', "." and ".."
+// components collapsed, so that the member extracts inside the current directory
+void ArchiveName(char *path, char *name, size_t size){
+    char *parts[128];
+    int count = 0;
+    char copy[1024];
+    strncpy(copy, path, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    for (char *part = strtok(copy, "/"); part; part = strtok(NULL, "/")){
+        if (strcmp(part, ".") == 0){
+            continue;
+        }
+        if (strcmp(part, "..") == 0){
+            if (count){
+                count--;
+            }
+            continue;
+        }
+        if (count < 128){
+            parts[count++] = part;
+        }
+    }
+    name[0] = '\0';
+    for (int i = 0; i < count; i++){
+        if (i){
+            strncat(name, "/", size - strlen(name) - 1);
+        }
+        strncat(name, parts[i], size - strlen(name) - 1);
+    }
+}
+
+
+int CompressFilesToArchive(char **files, int file_count, char *archive_name, int symbol_size){
     FILE *archive = fopen(archive_name, "wb");
     if (!archive){
         fprintf(stderr, "Failed to open archive.\n");
-        return;
+        return -1;
     }
     
-    // write total number of files to archive header
+    // write magic word and total number of files to archive header
+    int magic = ARCHIVE_MAGIC | ARCHIVE_VERSION << 24;
+    fwrite(&magic, sizeof(int), 1, archive);
     fwrite(&file_count, sizeof(int), 1, archive);
 
     file_index_t *index = calloc(file_count, sizeof(file_index_t));
@@ -153,86 +279,316 @@ void CompressFilesToArchive(char **files, int file_count, char *archive_name, in
     // skip space for index 
     fseek(archive, file_count * sizeof(file_index_t), SEEK_CUR);
 
+    // inputs that cannot be opened are left out of the index
+    int members = 0;
     for (int i = 0; i < file_count; i++){
         FILE *input = fopen(files[i], "rb");
         if (!input){
+            fprintf(stderr, "Failed to open input file: %s\n", files[i]);
             continue;
         }
-
-        int symbol_range = symbol_size == 8 ? 256 : 65536;
-        int *frequency = calloc(symbol_range, sizeof(int));
-        if (symbol_size == 8){
-            int c;
-            while ((c = fgetc(input)) != EOF){
-                frequency[c]++;
-            }
-        } else {
-            uint16_t symbol;
-            while ((fread(&symbol, 2, 1, input))){
-                frequency[symbol]++;
-            }
-        }
-        
-        rewind(input);
-        tree_node_t *tree = BuildHuffmanTree(symbol_range, frequency);
-        huffman_code_t *codes = calloc(symbol_range, sizeof(huffman_code_t));
-        char code[256];
-        BuildCodes(tree, codes, code, 0);
+        file_index_t *member = &index[members++];
 
         // get start position before compression
         long start = ftell(archive);
-        CompressTree(input, archive, codes, symbol_size, frequency);
+        StartFile();
+        CompressStream(input, archive, symbol_size);
         // get end position after compression
         long end = ftell(archive);
 
         // store file metadata
-        strncpy(index[i].filename, files[i], 255);
-        index[i].position = start;
-        index[i].length = end - start;
+        ArchiveName(files[i], member->filename, sizeof(member->filename));
+        if (strcmp(member->filename, files[i]) != 0 && !quiet){
+            fprintf(stderr, "Storing %s as %s\n", files[i], member->filename);
+        }
+        member->position = start;
+        member->length = end - start;
+        member->size = GetFileSize(files[i]);
 
-        printf("Compressed: %s\n", index[i].filename);
+        FinishFile(member->size, member->length);
+        if (!quiet){
+            printf("Compressed: %s\n", member->filename);
+        }
         fclose(input);
-        free(frequency);
-        free(codes);
-        FreeHuffmanTree(tree);
     }
-    // return to write index at reserved position
+    // return to write the real member count and the index; the reserved
+    // space of skipped inputs stays unused between the index and the data
     long end_pos = ftell(archive);
+    fseek(archive, sizeof(int), SEEK_SET);
+    fwrite(&members, sizeof(int), 1, archive);
     fseek(archive, index_pos, SEEK_SET);
-    fwrite(index, sizeof(file_index_t), file_count, archive);
+    fwrite(index, sizeof(file_index_t), members, archive);
+    AddStatsBytes(0, ARCHIVE_HEADER_SIZE + file_count * sizeof(file_index_t));
 
     fseek(archive, end_pos, SEEK_SET);
 
     free(index);
     fclose(archive);
+    // nothing was stored, no archive is left behind
+    if (!members){
+        remove(archive_name);
+        return -1;
+    }
+    return members == file_count ? 0 : -1;
 }
 
 
-void DecompressArchive(char *archive_name){
-    FILE *archive = fopen(archive_name, "rb");
-    if (!archive){
-        fprintf(stderr, "Failed to open archive.\n");
-        return;
+// members must lie inside the archive, after the index
+int ValidArchiveIndex(file_index_t *index, int count, long data_start, size_t size){
+    for (int i = 0; i < count; i++){
+        if (index[i].position < data_start || index[i].position > (long)size ||
+        index[i].length <= 0 || index[i].length > (long)size - index[i].position ||
+        index[i].size < 0 || !memchr(index[i].filename, '\0', sizeof(index[i].filename))){
+            return 0;
+        }
     }
+    return 1;
+}
 
-    int file_count;
-    fread(&file_count, sizeof(int), 1, archive);
-    file_index_t *index = calloc(file_count, sizeof(file_index_t));
-    fread(index, sizeof(file_index_t), file_count, archive);
 
-    for (int i = 0; i < file_count; i++){
-        fseek(archive, index[i].position, SEEK_SET);
-        FILE *output = fopen(index[i].filename, "wb");
-        if (!output){
-            fprintf(stderr, "Failed to write: %s\n", index[i].filename);
-            continue;
+// version 1 layout: member count, then name[256], position and length per member,
+// read into a current index with no original sizes
+file_index_t* ParseLegacyIndex(const unsigned char *data, size_t size, int *file_count){
+    int count;
+    memcpy(&count, data, sizeof(int));
+    if (count <= 0 || count > (long)(size - sizeof(int)) / (long)LEGACY_ENTRY_SIZE){
+        return NULL;
+    }
+    file_index_t *index = calloc(count, sizeof(file_index_t));
+    for (int i = 0; i < count; i++){
+        const unsigned char *entry = data + sizeof(int) + i * LEGACY_ENTRY_SIZE;
+        memcpy(index[i].filename, entry, 256);
+        memcpy(&index[i].position, entry + 256, sizeof(long));
+        memcpy(&index[i].length, entry + 256 + sizeof(long), sizeof(long));
+    }
+    if (!ValidArchiveIndex(index, count, LEGACY_HEADER_SIZE(count), size)){
+        free(index);
+        return NULL;
+    }
+    *file_count = count;
+    return index;
+}
+
+
+// format version of an archive held in memory, 0 if data is not an archive
+int ArchiveVersion(const unsigned char *data, size_t size){
+    if (size < sizeof(int)){
+        return 0;
+    }
+    unsigned int magic;
+    memcpy(&magic, data, sizeof(int));
+    if ((magic & 0xffffff) == ARCHIVE_MAGIC){
+        return magic >> 24;
+    }
+    int count;
+    file_index_t *index = ParseLegacyIndex(data, size, &count);
+    free(index);
+    return index ? 1 : 0;
+}
+
+
+// checks the index of a version 1 or current archive held in memory, NULL if it is not valid
+file_index_t* ParseArchiveIndex(const unsigned char *data, size_t size, int *file_count){
+    int version = ArchiveVersion(data, size);
+    if (version == 1){
+        return ParseLegacyIndex(data, size, file_count);
+    }
+    int count;
+    if (version != ARCHIVE_VERSION || size < ARCHIVE_HEADER_SIZE){
+        return NULL;
+    }
+    memcpy(&count, data + sizeof(int), sizeof(int));
+    if (count <= 0 || count > (long)(size - ARCHIVE_HEADER_SIZE) / (long)sizeof(file_index_t)){
+        return NULL;
+    }
+    // copied, the data may not be aligned for file_index_t
+    file_index_t *index = malloc(count * sizeof(file_index_t));
+    memcpy(index, data + ARCHIVE_HEADER_SIZE, count * sizeof(file_index_t));
+    if (!ValidArchiveIndex(index, count, ARCHIVE_HEADER_SIZE + count * sizeof(file_index_t), size)){
+        free(index);
+        return NULL;
+    }
+    *file_count = count;
+    return index;
+}
+
+
+// member names must stay inside the current directory
+int IsSafePath(char *path){
+    if (!path[0] || path[0] == '/'){
+        return 0;
+    }
+    for (char *part = path; part; part = strchr(part, '/')){
+        if (*part == '/'){
+            part++;
+        }
+        if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0')){
+            return 0;
         }
-        DecompressTree(archive, output);
+    }
+    return 1;
+}
+
+
+// decode one member straight from the mapped archive
+// create the directories of a member path (another worker may create them too)
+void MakeParentDirs(char *path){
+    char dir[256];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    for (char *slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')){
+        *slash = '\0';
+        mkdir(dir, 0755);
+        *slash = '/';
+    }
+}
+
+
+// returns 0 on success, -1 on failure (the output of a corrupted member is removed)
+int ExtractMember(const unsigned char *archive, file_index_t *member){
+    if (!IsSafePath(member->filename)){
+        fprintf(stderr, "Unsafe path: %s\n", member->filename);
+        return -1;
+    }
+    MakeParentDirs(member->filename);
+    int fd = open(member->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0){
+        fprintf(stderr, "Failed to write: %s\n", member->filename);
+        return -1;
+    }
+    // reserve the blocks up front, failure (e.g. unsupported by the fs) is harmless.
+    // the size comes from the index: skip it if the stream cannot decode to it
+    if (member->size > 0 && member->size <= MaxDecodedSize(archive + member->position, member->length)){
+        fallocate(fd, 0, 0, member->size);
+    }
+    FILE *output = fdopen(fd, "wb");
+    if (!output){
+        fprintf(stderr, "Failed to write: %s\n", member->filename);
+        close(fd);
+        unlink(member->filename);
+        return -1;
+    }
+
+    StartFile();
+    int result = DecompressMemory(archive + member->position, member->length, output);
+    fflush(output);
+    long written = ftell(output);
+    FinishFile(member->length, written);
+    if (result != 0){
+        fprintf(stderr, "Corrupted member: %s\n", member->filename);
         fclose(output);
-        printf("Extracted: %s\n", index[i].filename);
+        unlink(member->filename);
+        return -1;
+    }
+    // the index size may be off (preallocation is only a hint)
+    if (written != member->size && ftruncate(fd, written) != 0){
+        fprintf(stderr, "Failed to write: %s\n", member->filename);
+        result = -1;
+    }
+    if (fclose(output) != 0){
+        fprintf(stderr, "Failed to write: %s\n", member->filename);
+        result = -1;
+    }
+    if (!quiet && result == 0){
+        printf("Extracted: %s\n", member->filename);
+    }
+    return result;
+}
+
+
+typedef struct extract_job_t {
+    const unsigned char *archive;
+    file_index_t *index;
+    int file_count;
+    int next; // next member to extract, shared by the workers
+    int failed; // set when any member could not be extracted
+} extract_job_t;
+
+
+void* ExtractWorker(void *arg){
+    extract_job_t *job = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->file_count){
+        if (ExtractMember(job->archive, &job->index[i]) != 0){
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+
+// extracts the archive, returns 1 if the file is not an archive, -1 if it
+// cannot be opened, is corrupted or any member failed
+int DecompressArchive(char *archive_name){
+    int fd = open(archive_name, O_RDONLY);
+    if (fd < 0){
+        fprintf(stderr, "Error: Cannot open %s.\n", archive_name);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (long)sizeof(int)){
+        close(fd);
+        return 1;
+    }
+    // members are decoded from the mapping, no stdio buffering on the input side
+    const unsigned char *archive = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (archive == MAP_FAILED){
+        fprintf(stderr, "Failed to map archive.\n");
+        return -1;
+    }
+
+    int version = ArchiveVersion(archive, st.st_size);
+    if (!version){
+        munmap((void *)archive, st.st_size);
+        return 1;
+    }
+    int file_count;
+    file_index_t *index = NULL;
+    if (version > ARCHIVE_VERSION){
+        fprintf(stderr, "Unsupported archive version %d: %s\n", version, archive_name);
+    } else if (!(index = ParseArchiveIndex(archive, st.st_size, &file_count))){
+        fprintf(stderr, "Corrupted archive.\n");
+    }
+    if (!index){
+        munmap((void *)archive, st.st_size);
+        return -1;
     }
+    madvise((void *)archive, st.st_size, MADV_WILLNEED);
+
+    // the archive itself was counted as one file
+    long header_size = version == 1 ? LEGACY_HEADER_SIZE(file_count) :
+        (long)(ARCHIVE_HEADER_SIZE + file_count * sizeof(file_index_t));
+    AddStatsTotal(0, file_count - 1);
+    AdvanceProgress(header_size);
+    AddStatsBytes(header_size, 0);
+
+    int thread_count = jobs > 0 ? jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count > file_count){
+        thread_count = file_count;
+    }
+    if (thread_count < 1){
+        thread_count = 1;
+    }
+
+    extract_job_t job = {archive, index, file_count, 0, 0};
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    int started = 0;
+    for (; started < thread_count - 1; started++){
+        if (pthread_create(&threads[started], NULL, ExtractWorker, &job) != 0){
+            break;
+        }
+    }
+    // the calling thread works too, so a failed pthread_create only costs speed
+    ExtractWorker(&job);
+    for (int i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
     free(index);
-    fclose(archive);
+    munmap((void *)archive, st.st_size);
+    return job.failed ? -1 : 0;
 }
 
 
@@ -269,16 +625,18 @@ void CompressDir(char *path, int symbol_size){
 }
 
 
-void DecompressDir(char *path){
+// returns 0 if every file was decompressed, -1 otherwise
+int DecompressDir(char *path){
     DIR *dir = opendir(path);
     if (!dir){
         fprintf(stderr, "Cannot open directory.\n");
-        return;
+        return -1;
     }
 
     // path of output dir
     char archive_path[512];
-    strncpy(archive_path, path, sizeof(archive_path));
+    strncpy(archive_path, path, sizeof(archive_path) - 1);
+    archive_path[sizeof(archive_path) - 1] = '\0';
 
     // remove ".huff"
     char *dot = strrchr(archive_path, '.'); // find the last occurrence of a char
@@ -289,6 +647,7 @@ void DecompressDir(char *path){
     mkdir(archive_path, 0755);
 
     // reading files in dir
+    int result = 0;
     struct dirent *file;
     while((file = readdir(dir))){
         // build full path to file
@@ -307,7 +666,8 @@ void DecompressDir(char *path){
 
         // output filename (removing ".huff")
         char output_file_name[512];
-        strncpy(output_file_name, file->d_name, sizeof(output_file_name));
+        strncpy(output_file_name, file->d_name, sizeof(output_file_name) - 1);
+        output_file_name[sizeof(output_file_name) - 1] = '\0';
         char *dot = strrchr(output_file_name, '.');
         if (dot && strcmp(dot, ".huff") == 0){
             *dot = '\0';
@@ -316,9 +676,12 @@ void DecompressDir(char *path){
         // build full output path
         char output_path[1024];
         snprintf(output_path, sizeof(output_path), "%s/%s", archive_path, output_file_name);
-        DecompressFileTo(input_path, output_path);
+        if (DecompressFileTo(input_path, output_path) != 0){
+            result = -1;
+        }
     }
 
     closedir(dir);  
+    return result;
 }
 
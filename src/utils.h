@@ -1,21 +1,43 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
+
+// archives start with "HUF" and the format version byte, then the member
+// count and the index. version 1 had no magic word and no size field
+#define ARCHIVE_MAGIC 0x00465548
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_HEADER_SIZE (2 * sizeof(int))
+// a version 1 index entry is name[256], position and length
+#define LEGACY_ENTRY_SIZE (256 + 2 * sizeof(long))
+#define LEGACY_HEADER_SIZE(count) ((long)(sizeof(int) + (count) * LEGACY_ENTRY_SIZE))
+
 typedef struct file_index_t {
     char filename[256];
     long position;
     long length;
+    long size; // original size, to preallocate on extraction
 } file_index_t;
 
+// silence per-file messages
+extern int quiet;
+// threads for archive extraction, 0 for one per CPU
+extern int jobs;
+
 int IsDir(char *path);
 long GetFileSize(char *file);
+void CountInput(char *path, long *bytes, int *files);
+void CompressStream(FILE *input, FILE *output, int symbol_size);
 void CompressFileTo(char *input_path, char *output_path, int symbol_size);
 void CompressFile(char *path, int symbol_size);
-void DecompressFileTo(char *input_path, char *output_path);
-void DecompressFile(char *path);
-void CompressFilesToArchive(char **files, int file_count, char *archive_name, int symbol_size);
-void DecompressArchive(char *archive_name);
+int DecompressFileTo(char *input_path, char *output_path);
+int DecompressFile(char *path);
+int ArchiveVersion(const unsigned char *data, size_t size);
+file_index_t* ParseArchiveIndex(const unsigned char *data, size_t size, int *file_count);
+int IsSafePath(char *path);
+int CompressFilesToArchive(char **files, int file_count, char *archive_name, int symbol_size);
+int DecompressArchive(char *archive_name);
 void CompressDir(char *path, int symbol_size);
-void DecompressDir(char *path);
+int DecompressDir(char *path);
 
 #endif
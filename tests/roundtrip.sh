@@ -0,0 +1,232 @@
+#!/bin/sh
+# differential round-trip harness: every mode and transform on edge-case
+# inputs. compressed output must not depend on the kernels, every stream
+# and archive must decode back to its input, and damaged streams must be
+# rejected without crashing (truncated ones with exit status 1).
+# usage: roundtrip.sh path/to/huff
+HUFF=$(cd "$(dirname "${1:-./huff}")" && pwd)/$(basename "${1:-./huff}")
+ORIGIN=$(pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+failures=0
+checks=0
+
+fail(){
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+# a run that died on a signal (or sanitizer abort) is a crash
+crashed(){
+    [ "$1" -ge 128 ] || grep -q "Sanitizer\|runtime error" err
+}
+
+
+# ======== INPUTS ========
+
+mkdir inputs
+: > inputs/empty
+printf 'A' > inputs/one
+awk 'BEGIN{srand(7); for (i = 0; i < 12000; i++) printf "%s%s", i % 17 ? "word" int(rand() * 40) : "line", i % 11 ? " " : "\n"}' | head -c 100001 > inputs/odd
+head -c 262145 /dev/urandom > inputs/random
+for i in 1 2 3 4 5 6 7 8; do
+    head -c $((i * 3000)) /dev/zero
+    head -c 200 /dev/urandom
+    yes "$i" | head -c $((i * 1000))
+done > inputs/runs
+INPUTS="empty one odd random runs"
+
+# kernels this CPU can run
+KERNELS=""
+for cpu in generic sse42 avx2; do
+    if "$HUFF" -q --cpu=$cpu inputs/one 2>/dev/null; then
+        KERNELS="$KERNELS $cpu"
+    fi
+    rm -f inputs/one.huff
+done
+
+
+# ======== SINGLE STREAMS ========
+
+for size in -1 -2 -x; do
+    for transform in none rle delta mtf auto; do
+        mode="$size -t $transform"
+        for input in $INPUTS; do
+            reference=""
+            for cpu in $KERNELS; do
+                checks=$((checks + 1))
+                cp inputs/$input case
+                "$HUFF" -q --cpu=$cpu $mode case 2>err
+                status=$?
+                if crashed $status || [ ! -f case.huff ]; then
+                    fail "compress $input $mode --cpu=$cpu"
+                    continue
+                fi
+                if [ -z "$reference" ]; then
+                    reference=$cpu
+                    cp case.huff reference.huff
+                elif ! cmp -s case.huff reference.huff; then
+                    fail "$input $mode: --cpu=$cpu output differs from --cpu=$reference"
+                fi
+                rm -f case
+                "$HUFF" -q --cpu=$cpu -d case.huff 2>err
+                status=$?
+                if crashed $status || [ $status -ne 0 ] || ! cmp -s case inputs/$input; then
+                    fail "round trip $input $mode --cpu=$cpu"
+                fi
+                rm -f case case.huff
+            done
+            mv reference.huff streams_$input$size-$transform.huff 2>/dev/null
+        done
+    done
+done
+
+
+# ======== ARCHIVES ========
+
+archive_number=0
+for mode in "-1" "-2 -t delta" "-x -t mtf" "-t auto"; do
+    archive_number=$((archive_number + 1))
+    for jobs in 1 4; do
+        checks=$((checks + 1))
+        rm -rf archive && mkdir archive && cd archive || exit 1
+        cp ../inputs/* .
+        "$HUFF" -q $mode $INPUTS 2>../err
+        mkdir out && cd out || exit 1
+        "$HUFF" -q -j $jobs -d ../archive.huff 2>../../err
+        status=$?
+        cd ../.. || exit 1
+        if crashed $status || [ $status -ne 0 ]; then
+            fail "archive $mode -j $jobs: exit status $status"
+        fi
+        for input in $INPUTS; do
+            if ! cmp -s archive/out/$input inputs/$input; then
+                fail "archive $mode -j $jobs: $input"
+            fi
+        done
+    done
+    cp archive/archive.huff archives_$archive_number.huff
+done
+
+# absolute and ".." paths are stored relative, the way tar stores them
+checks=$((checks + 1))
+rm -rf archive && mkdir -p archive/sub && cd archive || exit 1
+cp ../inputs/odd sub/odd
+cp ../inputs/runs runs
+"$HUFF" -q "$WORK/inputs/one" sub/../runs ./sub/odd 2>../err
+mkdir out && cd out || exit 1
+"$HUFF" -q -d ../archive.huff 2>../../err
+status=$?
+cd ../.. || exit 1
+if crashed $status || [ $status -ne 0 ]; then
+    fail "archive of absolute paths: exit status $status"
+fi
+for pair in "${WORK#/}/inputs/one:one" "runs:runs" "sub/odd:odd"; do
+    if ! cmp -s "archive/out/${pair%%:*}" "inputs/${pair#*:}"; then
+        fail "archive of absolute paths: ${pair%%:*}"
+    fi
+done
+
+# an input that cannot be opened fails the run, the others are still stored
+checks=$((checks + 1))
+rm -rf archive && mkdir archive && cd archive || exit 1
+cp ../inputs/odd ../inputs/runs .
+"$HUFF" -q odd missing runs 2>../err
+status=$?
+mkdir out && cd out || exit 1
+"$HUFF" -q -d ../archive.huff 2>../../err
+extract_status=$?
+cd ../.. || exit 1
+if crashed $status || [ $status -ne 1 ]; then
+    fail "archive with a missing input: exit status $status"
+elif crashed $extract_status || [ $extract_status -ne 0 ]; then
+    fail "archive with a missing input: extraction exit status $extract_status"
+fi
+for input in odd runs; do
+    if ! cmp -s archive/out/$input inputs/$input; then
+        fail "archive with a missing input: $input"
+    fi
+done
+
+# version 1 archives: member count, then name[256], position and length per
+# member, in the byte order and long size of the machine that wrote them
+little_endian(){
+    value=$1
+    bytes=""
+    for i in $(seq $2); do
+        bytes="$bytes\\$(printf %03o $((value & 255)))"
+        value=$((value >> 8))
+    done
+    printf "$bytes"
+}
+checks=$((checks + 1))
+rm -rf archive && mkdir archive || exit 1
+position=$((4 + 2 * 272))
+{
+    little_endian 2 4
+    for input in odd runs; do
+        length=$(wc -c < streams_$input-1-none.huff)
+        printf %s $input
+        head -c $((256 - ${#input})) /dev/zero
+        little_endian $position 8
+        little_endian $length 8
+        position=$((position + length))
+    done
+    cat streams_odd-1-none.huff streams_runs-1-none.huff
+} > archives_v1.huff
+(cd archive && "$HUFF" -q -d ../archives_v1.huff 2>../err)
+status=$?
+if crashed $status || [ $status -ne 0 ]; then
+    fail "version 1 archive: exit status $status"
+fi
+for input in odd runs; do
+    if ! cmp -s archive/$input inputs/$input; then
+        fail "version 1 archive: $input"
+    fi
+done
+
+
+# ======== DAMAGED STREAMS ========
+
+# truncated and overwritten copies of every stream and archive
+seed=1
+for stream in streams_*.huff archives_*.huff; do
+    length=$(wc -c < "$stream")
+    for cut in 0 1 4 8 $((length / 2)) $((length - 1)); do
+        checks=$((checks + 1))
+        rm -rf damaged && mkdir damaged
+        head -c $cut "$stream" > damaged/case.huff
+        (cd damaged && "$HUFF" -q -d case.huff 2>../err)
+        status=$?
+        if crashed $status; then
+            fail "truncated $stream at $cut"
+        elif [ $status -ne 1 ]; then
+            fail "truncated $stream at $cut: exit status $status"
+        elif [ -f damaged/case ]; then
+            fail "truncated $stream at $cut: output of the failed stream left behind"
+        fi
+    done
+    for round in 1 2 3 4; do
+        checks=$((checks + 1))
+        seed=$((seed + 1))
+        rm -rf damaged && mkdir damaged
+        cp "$stream" damaged/case.huff
+        for position in $(awk -v seed=$seed -v size=$length 'BEGIN{srand(seed); for (i = 0; i < 4; i++) print int(rand() * (i < 2 && size > 64 ? 64 : size))}'); do
+            head -c 1 /dev/urandom | dd of=damaged/case.huff bs=1 seek=$position conv=notrunc 2>/dev/null
+        done
+        (cd damaged && "$HUFF" -q -d case.huff 2>../err)
+        if crashed $?; then
+            cp damaged/case.huff "$ORIGIN/crash_$seed.huff"
+            fail "damaged $stream (seed $seed), saved as crash_$seed.huff"
+        fi
+    done
+done
+
+
+if [ $failures -ne 0 ]; then
+    echo "$failures of $checks checks failed"
+    exit 1
+fi
+echo "All $checks checks passed (kernels:$KERNELS)"